@@ -2,14 +2,369 @@
 // Each array in the SoA is allocated in a contiguous storage container.
 // Run via https://godbolt.org/z/r57Phe8do
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <filesystem>
 #include <experimental/meta>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace mds {
 
 using namespace std::literals;
 
+///
+// Column expressions: trees of storage vectors, constants and arithmetic, built lazily and
+// evaluated element by element in a single fused pass
+///
+
+struct expression_node {};
+
+template <typename E>
+concept expression = std::derived_from<std::remove_cvref_t<E>, expression_node>;
+template <typename E>
+concept operand = expression<E> || std::is_arithmetic_v<E>;
+
+// Leaf referring to a storage vector
+template <typename S>
+struct column : expression_node {
+    S *data;
+    size_t n;
+
+    column(S *data, size_t n) : data(data), n(n) {}
+    column(const column &) = default;
+
+    auto size() const -> size_t { return n; }
+    auto operator[](size_t i) const -> S & { return data[i]; }
+
+    // Evaluate an expression of the same size into this column
+    template <expression E>
+        requires(!std::is_const_v<S>)
+    auto operator=(const E &e) -> column & {
+        if (e.size() != n) throw std::invalid_argument("expression and column of different sizes");
+        for (size_t i = 0; i < n; i++) data[i] = e[i];
+        return *this;
+    }
+    auto operator=(const column &e) -> column &
+        requires(!std::is_const_v<S>)
+    {
+        return operator= <column>(e);
+    }
+};
+
+// Leaf broadcasting a number
+template <typename S>
+struct constant : expression_node {
+    S value;
+
+    auto operator[](size_t) const -> S { return value; }
+};
+
+template <typename Op, typename E>
+struct unary : expression_node {
+    E arg;
+
+    auto size() const -> size_t { return arg.size(); }
+    auto operator[](size_t i) const { return Op{}(arg[i]); }
+};
+
+template <typename Op, typename L, typename R>
+struct binary : expression_node {
+    L lhs;
+    R rhs;
+
+    auto size() const -> size_t {
+        if constexpr (requires { lhs.size(); })
+            return lhs.size();
+        else
+            return rhs.size();
+    }
+    auto operator[](size_t i) const { return Op{}(lhs[i], rhs[i]); }
+};
+
+template <operand E>
+auto as_expression(const E &e) {
+    if constexpr (expression<E>)
+        return e;
+    else
+        return constant<E>{{}, e};
+}
+
+template <typename Op, operand L, operand R>
+    requires(expression<L> || expression<R>)
+auto make_binary(const L &lhs, const R &rhs) {
+    auto l = as_expression(lhs);
+    auto r = as_expression(rhs);
+    if constexpr (requires { l.size() + r.size(); })
+        if (l.size() != r.size()) throw std::invalid_argument("operands of different sizes");
+    return binary<Op, decltype(l), decltype(r)>{{}, l, r};
+}
+
+template <operand L, operand R>
+auto operator+(const L &lhs, const R &rhs) {
+    return make_binary<std::plus<>>(lhs, rhs);
+}
+template <operand L, operand R>
+auto operator-(const L &lhs, const R &rhs) {
+    return make_binary<std::minus<>>(lhs, rhs);
+}
+template <operand L, operand R>
+auto operator*(const L &lhs, const R &rhs) {
+    return make_binary<std::multiplies<>>(lhs, rhs);
+}
+template <operand L, operand R>
+auto operator/(const L &lhs, const R &rhs) {
+    return make_binary<std::divides<>>(lhs, rhs);
+}
+template <expression E>
+auto operator-(const E &e) {
+    return unary<std::negate<>, E>{{}, e};
+}
+
+// Fold an expression in one pass. The elements are spread over independent accumulators so the
+// loop vectorizes, which assumes op is associative and commutative, e.g. reduce(x * y, 0.0) is
+// the dot product of x and y.
+template <size_t Lanes = 8, expression E, typename U, typename Op = std::plus<>>
+auto reduce(const E &e, U init, Op op = {}) -> U {
+    size_t n = e.size();
+    size_t i = 0;
+    if (n >= Lanes) {
+        U acc[Lanes];
+        for (size_t l = 0; l < Lanes; l++) acc[l] = e[l];
+        for (i = Lanes; i + Lanes <= n; i += Lanes)
+            for (size_t l = 0; l < Lanes; l++) acc[l] = op(acc[l], e[i + l]);
+        for (size_t l = 0; l < Lanes; l++) init = op(init, acc[l]);
+    }
+    for (; i < n; i++) init = op(init, e[i]);
+    return init;
+}
+
+// Count, sum, extrema, mean and population variance of a sequence of numbers, accumulated in one
+// pass
+struct summary {
+    size_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    double mean = 0;
+    double m2 = 0;  // Sum of squared differences from the mean
+
+    auto variance() const -> double { return count ? m2 / count : 0; }
+
+    // Welford's update
+    auto push(double x) -> void {
+        count++;
+        sum += x;
+        min = std::min(min, x);
+        max = std::max(max, x);
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    // Chan's parallel combination
+    auto merge(const summary &other) -> void {
+        if (other.count == 0) return;
+        size_t n = count + other.count;
+        double delta = other.mean - mean;
+        mean += delta * other.count / n;
+        m2 += other.m2 + delta * delta * count * other.count / n;
+        count = n;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+// Summarize several expressions of the same size in one pass over all of them, each spread over
+// independent accumulators like reduce
+template <size_t Lanes = 8, expression... E>
+auto summarize(const E &...e) -> std::array<summary, sizeof...(E)> {
+    auto columns = std::forward_as_tuple(e...);
+    size_t n = std::get<0>(columns).size();
+    if (((e.size() != n) || ...)) throw std::invalid_argument("expressions of different sizes");
+
+    std::array<std::array<summary, Lanes>, sizeof...(E)> acc{};
+    std::array<summary, sizeof...(E)> out{};
+    [&]<size_t... C>(std::index_sequence<C...>) {
+        size_t i = 0;
+        for (; i + Lanes <= n; i += Lanes)
+            (
+                [&] {
+                    for (size_t l = 0; l < Lanes; l++) acc[C][l].push(std::get<C>(columns)[i + l]);
+                }(),
+                ...);
+        for (; i < n; i++) (out[C].push(std::get<C>(columns)[i]), ...);
+    }(std::index_sequence_for<E...>{});
+
+    for (size_t c = 0; c < sizeof...(E); c++)
+        for (size_t l = 0; l < Lanes; l++) out[c].merge(acc[c][l]);
+    return out;
+}
+
+// Hash of a group_by key. Multiplying by 2^64 / phi (Fibonacci hashing) spreads keys whose
+// std::hash is the identity over the high bits, which index the table.
+template <typename K>
+auto hash_key(const K &key) -> uint64_t {
+    return std::hash<K>{}(key) * 0x9E3779B97F4A7C15ull;
+}
+
+///
+// Space filling curve ordering
+///
+
+// Quantization of N coordinates onto a grid of 2^bits cells per axis spanning their bounding box,
+// and the Morton (Z-order) key of a grid point, which interleaves the bits of its N cell
+// coordinates
+template <size_t N>
+struct morton_grid {
+    static constexpr size_t bits = std::min<size_t>(32, 64 / N);
+
+    std::array<double, N> lo, hi;
+    std::array<double, N> scale;  // Cells per unit length along each axis
+
+    morton_grid(const std::array<double, N> &lo, const std::array<double, N> &hi) : lo(lo), hi(hi) {
+        for (size_t d = 0; d < N; d++)
+            scale[d] = hi[d] > lo[d] ? std::ldexp(1.0, bits) / (hi[d] - lo[d]) : 0;
+    }
+
+    // Cell coordinate of c along axis d. Coordinates off the grid are clamped to its border cells,
+    // and NaN to the first.
+    auto quantize(size_t d, double c) const -> uint64_t {
+        double q = (c - lo[d]) * scale[d];
+        if (!(q > 0)) return 0;
+        return q < std::ldexp(1.0, bits) ? static_cast<uint64_t>(q) : (uint64_t(1) << bits) - 1;
+    }
+
+    // Interleave the lowest n_bits bits of each cell coordinate
+    static auto interleave(const std::array<uint64_t, N> &q, size_t n_bits) -> uint64_t {
+        uint64_t key = 0;
+        for (size_t b = 0; b < n_bits; b++)
+            for (size_t d = 0; d < N; d++) key |= ((q[d] >> b) & 1) << (b * N + d);
+        return key;
+    }
+
+    auto key(const std::array<double, N> &p) const -> uint64_t {
+        std::array<uint64_t, N> q;
+        for (size_t d = 0; d < N; d++) q[d] = quantize(d, p[d]);
+        return interleave(q, bits);
+    }
+};
+
+struct index_range {
+    size_t begin, end;
+};
+
+// Morton ordered elements bucketed into 2^level cells per axis. As the elements are sorted by
+// Morton key, every cell holds a contiguous range of indices, and queries return the merged ranges
+// of the cells they overlap. Elements of cells on the border of a query may lie outside of it.
+template <size_t N>
+struct cell_index {
+    static constexpr size_t max_cell_bits = 24;  // At most 2^24 cells, a level of at most 24 / N
+
+    morton_grid<N> grid;
+    size_t level;
+    std::vector<size_t> cell_begin;  // Elements of cell c are [cell_begin[c], cell_begin[c + 1])
+
+    // Cell coordinate of c along axis d
+    auto cell(size_t d, double c) const -> uint64_t {
+        return grid.quantize(d, c) >> (grid.bits - level);
+    }
+
+    // Elements of the cells overlapping the box [lo, hi]
+    auto box(const std::array<double, N> &lo, const std::array<double, N> &hi) const
+        -> std::vector<index_range> {
+        return overlapping_cells(lo, hi, [](const std::array<uint64_t, N> &) { return true; });
+    }
+
+    // Elements of the cells within distance r of center
+    auto radius(const std::array<double, N> &center, double r) const -> std::vector<index_range> {
+        std::array<double, N> lo, hi;
+        for (size_t d = 0; d < N; d++) {
+            lo[d] = center[d] - r;
+            hi[d] = center[d] + r;
+        }
+        return overlapping_cells(lo, hi, [&](const std::array<uint64_t, N> &c) {
+            double distance2 = 0;
+            for (size_t d = 0; d < N; d++) {
+                double width = std::ldexp(grid.hi[d] - grid.lo[d], -static_cast<int>(level));
+                double nearest = std::clamp(center[d], grid.lo[d] + c[d] * width,
+                                            grid.lo[d] + (c[d] + 1) * width);
+                distance2 += (center[d] - nearest) * (center[d] - nearest);
+            }
+            return distance2 <= r * r;
+        });
+    }
+
+    // Visit the cells of the box [lo, hi] accepted by keep, and collect their index ranges in order
+    template <typename Keep>
+    auto overlapping_cells(const std::array<double, N> &lo, const std::array<double, N> &hi,
+                           Keep keep) const -> std::vector<index_range> {
+        std::array<uint64_t, N> first, last;
+        for (size_t d = 0; d < N; d++) {
+            if (hi[d] < grid.lo[d] || lo[d] > grid.hi[d] || hi[d] < lo[d]) return {};
+            first[d] = cell(d, lo[d]);
+            last[d] = cell(d, hi[d]);
+        }
+
+        std::vector<index_range> ranges;
+        for (auto c = first;;) {
+            auto code = grid.interleave(c, level);
+            if (cell_begin[code] != cell_begin[code + 1] && keep(c))
+                ranges.push_back({cell_begin[code], cell_begin[code + 1]});
+
+            size_t d = 0;
+            for (; d < N && c[d] == last[d]; d++) c[d] = first[d];
+            if (d == N) break;
+            c[d]++;
+        }
+
+        std::sort(ranges.begin(), ranges.end(), [](auto &a, auto &b) { return a.begin < b.begin; });
+        std::vector<index_range> merged;
+        for (auto &range : ranges) {
+            if (!merged.empty() && merged.back().end == range.begin)
+                merged.back().end = range.end;
+            else
+                merged.push_back(range);
+        }
+        return merged;
+    }
+};
+
 consteval auto gen_sov_members(std::meta::info t) -> void {
     for (auto member : nonstatic_data_members_of(t)) {
         auto vec_member = ^{
@@ -30,8 +385,24 @@ consteval auto gen_sor_members(std::meta::info t) -> void {
     }
 }
 
+// One array of block values per member, e.g. double x[8], y[8], z[8], value[8];
+consteval auto gen_block_members(std::meta::info t, size_t block) -> void {
+    for (auto member : nonstatic_data_members_of(t)) {
+        queue_injection(^{
+          typename[:\(type_of(member)):] \id(name_of(member))[\(block)];
+        });
+    }
+}
+
 template <typename T, size_t Alignment>
 class vector {
+    template <typename, size_t>
+    friend class vector;
+    template <typename, size_t>
+    friend class loader;
+    template <typename>
+    friend class tuned_vector;
+
     // ------------ generate -----------
     //   private:
     //      std::vector<std::byte> storage;
@@ -54,30 +425,27 @@ class vector {
         return ((size + alignment - 1) / alignment) * alignment;
     }
 
-   public:
-    vector(std::initializer_list<T> data) {
+    // Carve one aligned storage vector of n elements per member out of storage
+    auto allocate(size_t n) -> void {
         auto n_members = [:std::meta::reflect_value(nonstatic_data_members_of(^T).size()):];
 
         size_t total_size = 0;
         std::vector<size_t> byte_sizes;
         byte_sizes.reserve(n_members);
+        sizes.clear();
         sizes.reserve(n_members);
 
         // Compute the number of bytes needed for each storage vector and the
         // total number of storage bytes.
         size_t m_idx = 0;
         [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
-            byte_sizes.push_back(align_size(data.size() * sizeof(typename[:type_of(e):]), Alignment));
-            sizes.push_back(data.size());
-
-            std::cout << "_" << name_of(e) << " = " << sizes[m_idx] << " elements in "
-                      << byte_sizes[m_idx] << " bytes\n";
+            byte_sizes.push_back(align_size(n * sizeof(typename[:type_of(e):]), Alignment));
+            sizes.push_back(n);
             total_size += byte_sizes[m_idx];
             m_idx++;
         };
 
         storage.resize(total_size);
-        std::cout << "storage of " << total_size << " bytes in total\n\n";
 
         // Loop over storage vectors
         size_t offset = 0;
@@ -96,9 +464,30 @@ class vector {
                                 byte_sizes[m_idx] / sizeof(typename[: \(type):]));
                 });
             }
-            offset += byte_sizes[m_idx];
+            offset += byte_sizes[m_idx++];
+        };
+    }
+
+    // Storage vector of a member of T, e.g. sov<^T::x>() is _x
+    template <std::meta::info Member>
+    auto sov() const -> std::span<typename[:type_of(Member):]> {
+        consteval {
+            queue_injection(^{
+              return \id("_"sv, name_of(Member));
+            });
+        }
+    }
 
-            // Fill storage vector
+    // Tag of the constructor of vectors built by the library, which does not print their layout
+    struct quiet_t {};
+
+    // n elements left uninitialized
+    vector(quiet_t, std::size_t n) { allocate(n); }
+
+    // Copy of data
+    vector(quiet_t, std::span<const T> data) : vector(quiet_t{}, data.size()) {
+        // Fill storage vectors
+        [:expand(nonstatic_data_members_of(^T)):] >> [&, this]<auto e> {
             size_t e_idx = 0;
             for (auto elem : data) {
                 consteval {
@@ -113,6 +502,38 @@ class vector {
         };
     }
 
+    // Print the size of every storage vector, from the constructors used by the demo
+    auto print_layout() const -> void {
+        [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+            std::cout << "_" << name_of(e) << " = " << size() << " elements in "
+                      << sov<e>().size_bytes() << " bytes\n";
+        };
+        std::cout << "storage of " << storage.size() << " bytes in total\n\n";
+    }
+
+    // Ask the cache for row idx of every storage vector
+    auto prefetch(std::size_t idx) const -> void {
+        consteval {
+            for (auto member : nonstatic_data_members_of(^T)) {
+                // e.g., __builtin_prefetch(&_x[idx]);
+                queue_injection(^{
+                  __builtin_prefetch(&\id("_"sv, name_of(member))[idx]);
+                });
+            }
+        }
+    }
+
+   public:
+    static auto name() -> std::string { return "soa"; }
+
+    vector(std::initializer_list<T> data)
+        : vector(std::span<const T>(data.begin(), data.size())) {}
+
+    // n elements left uninitialized, e.g. to be filled by scatter
+    explicit vector(std::size_t n) : vector(quiet_t{}, n) { print_layout(); }
+
+    vector(std::span<const T> data) : vector(quiet_t{}, data) { print_layout(); }
+
     auto size() const -> std::size_t { return sizes[0]; }
 
     auto operator[](std::size_t m_idx) const -> aos_view {
@@ -133,6 +554,1021 @@ class vector {
             });
         }
     }
+
+    // Copy elements into [first, first + elements.size()), one storage vector at a time
+    auto scatter(std::size_t first, std::span<const T> elements) -> void {
+        consteval {
+            for (auto member : nonstatic_data_members_of(^T)) {
+                // e.g., for (size_t k = 0; k < elements.size(); k++) _x[first + k] = elements[k].x;
+                queue_injection(^{
+                  for (size_t k = 0; k < elements.size(); k++)
+                      \id("_"sv, name_of(member))[first + k] = elements[k].\id(name_of(member));
+                });
+            }
+        }
+    }
+
+    // Mutable value of a member of element idx
+    template <std::meta::info Member>
+    auto at(std::size_t idx) -> typename[:type_of(Member):] & {
+        return sov<Member>()[idx];
+    }
+
+    // Column expression leaf over a member, e.g.
+    //     maos.col<^data::z>() = maos.col<^data::x>() * 2 + maos.col<^data::y>();
+    template <std::meta::info Member>
+    auto col() -> column<typename[:type_of(Member):]> {
+        return {sov<Member>().data(), size()};
+    }
+    template <std::meta::info Member>
+    auto col() const -> column<const typename[:type_of(Member):]> {
+        return {sov<Member>().data(), size()};
+    }
+
+    // Fold all values of a member, e.g. reduce<^data::x>(std::plus<>{}) is their sum
+    template <std::meta::info Member, typename Op = std::plus<>>
+        requires(!std::is_arithmetic_v<Op>)
+    auto reduce(Op op = {}) const -> typename[:type_of(Member):] {
+        using S = typename[:type_of(Member):];
+        auto values = col<Member>();
+        if (size() == 0) return {};
+        return mds::reduce(column<const S>(values.data + 1, size() - 1), values[0], op);
+    }
+
+    // Fold all values of a member onto init, e.g. reduce<^data::x>(0.0) is their sum, as for the
+    // jagged vector
+    template <std::meta::info Member, typename U, typename Op = std::plus<>>
+        requires(std::is_arithmetic_v<U>)
+    auto reduce(U init, Op op = {}) const -> U {
+        return mds::reduce(col<Member>(), init, op);
+    }
+
+    // Summaries of several members, computed in one pass
+    template <std::meta::info... Members>
+    auto summarize() const -> std::array<summary, sizeof...(Members)> {
+        return mds::summarize(col<Members>()...);
+    }
+
+    // Elements grouped by the value of a key member, with groups numbered in order of first
+    // appearance
+    template <typename K>
+    struct grouping {
+        const vector &source;
+        std::vector<K> keys;        // Key of each group
+        std::vector<size_t> group;  // Group of each element
+
+        // Fold the values of a member per group, e.g.
+        // aggregate<^data::value>(0.0, std::plus<>{}) sums them
+        template <std::meta::info Member, typename U, typename Op>
+        auto aggregate(U init, Op op) const -> std::vector<U> {
+            auto values = source.sov<Member>();
+            std::vector<U> acc(keys.size(), init);
+            for (size_t i = 0; i < group.size(); i++) acc[group[i]] = op(acc[group[i]], values[i]);
+            return acc;
+        }
+
+        // Summary of the values of a member per group
+        template <std::meta::info Member>
+        auto aggregate() const -> std::vector<summary> {
+            auto values = source.sov<Member>();
+            std::vector<summary> acc(keys.size());
+            for (size_t i = 0; i < group.size(); i++) acc[group[i]].push(values[i]);
+            return acc;
+        }
+    };
+
+    // Group the elements by the value of a member. Keys are looked up in an open addressing table
+    // of (key, group) slots probed linearly, so that a lookup usually touches a single cache line.
+    // The table is sized after the number of distinct keys rather than the number of elements, so
+    // low cardinality keys stay in cache.
+    template <std::meta::info Key>
+    auto group_by() const -> grouping<typename[:type_of(Key):]> {
+        using K = typename[:type_of(Key):];
+        auto keys = sov<Key>();
+
+        struct slot {
+            K key;
+            size_t group;
+        };
+        constexpr size_t empty = std::numeric_limits<size_t>::max();
+
+        grouping<K> g{*this, {}, std::vector<size_t>(size())};
+        std::vector<slot> table;
+        size_t shift = 0;
+
+        auto find = [&](const K &key) -> slot & {
+            size_t mask = table.size() - 1;
+            size_t h = hash_key(key) >> shift;
+            while (table[h].group != empty && !(table[h].key == key)) h = (h + 1) & mask;
+            return table[h];
+        };
+        auto rehash = [&](size_t capacity) {
+            table.assign(capacity, {K{}, empty});
+            shift = 64 - std::countr_zero(capacity);
+            for (size_t group = 0; group < g.keys.size(); group++)
+                find(g.keys[group]) = {g.keys[group], group};
+        };
+
+        rehash(64);
+        for (size_t i = 0; i < size(); i++) {
+            auto &s = find(keys[i]);
+            size_t group = s.group;
+            if (group == empty) {
+                group = g.keys.size();
+                s = {keys[i], group};
+                g.keys.push_back(keys[i]);
+                // Keep the load factor at most 1/2
+                if (2 * g.keys.size() > table.size()) rehash(2 * table.size());
+            }
+            g.group[i] = group;
+        }
+        return g;
+    }
+
+    // Sort all storage vectors by the Morton key of the coordinate members Coords, so that
+    // elements close in space are close in memory. Returns the grid the keys are computed on.
+    template <std::meta::info... Coords>
+    auto reorder_morton() -> morton_grid<sizeof...(Coords)> {
+        auto bounds = summarize<Coords...>();
+        std::array<double, sizeof...(Coords)> lo, hi;
+        for (size_t d = 0; d < sizeof...(Coords); d++) {
+            lo[d] = bounds[d].min;
+            hi[d] = bounds[d].max;
+        }
+        morton_grid grid(lo, hi);
+
+        std::vector<std::pair<uint64_t, size_t>> keys(size());
+        for (size_t i = 0; i < size(); i++) keys[i] = {grid.key({sov<Coords>()[i]...}), i};
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<size_t> order(size());
+        for (size_t i = 0; i < size(); i++) order[i] = keys[i].second;
+
+        vector sorted(quiet_t{}, 0);
+        gather(order, sorted);
+        *this = std::move(sorted);
+        return grid;
+    }
+
+    // Sort the elements along the Morton curve of the coordinate members Coords and bucket them
+    // into 2^level cells per axis, level being at most morton_grid<sizeof...(Coords)>::bits and
+    // cell_index<sizeof...(Coords)>::max_cell_bits / N
+    template <std::meta::info... Coords>
+    auto spatial_index(size_t level) -> cell_index<sizeof...(Coords)> {
+        constexpr size_t N = sizeof...(Coords);
+        if (level > morton_grid<N>::bits || level > cell_index<N>::max_cell_bits / N)
+            throw std::invalid_argument("spatial index level " + std::to_string(level) +
+                                        " is too deep");
+        cell_index<N> index{reorder_morton<Coords...>(), level,
+                            std::vector<size_t>((size_t(1) << (N * level)) + 1)};
+
+        for (size_t i = 0; i < size(); i++) {
+            size_t d = 0;
+            std::array<uint64_t, N> c{index.cell(d++, sov<Coords>()[i])...};
+            index.cell_begin[index.grid.interleave(c, level) + 1]++;
+        }
+        for (size_t c = 1; c < index.cell_begin.size(); c++)
+            index.cell_begin[c] += index.cell_begin[c - 1];
+        return index;
+    }
+
+    // Call f(k, (*this)[idx[k]]) for every k. Indices are processed in batches of Batch, and the
+    // rows of the next batch are prefetched before the current one is visited, so that random
+    // lookups overlap their cache misses.
+    template <size_t Batch = 16, typename F>
+    auto for_each_indexed(std::span<const size_t> idx, F &&f) const -> void {
+        auto prefetch_batch = [&](size_t first) {
+            for (size_t k = first; k < std::min(first + Batch, idx.size()); k++) prefetch(idx[k]);
+        };
+
+        prefetch_batch(0);
+        for (size_t first = 0; first < idx.size(); first += Batch) {
+            prefetch_batch(first + Batch);
+            for (size_t k = first; k < std::min(first + Batch, idx.size()); k++) f(k, (*this)[idx[k]]);
+        }
+    }
+
+    // Copy the elements selected by idx into a dense AoS buffer of at least as many elements,
+    // out[k] = (*this)[idx[k]]
+    template <size_t Batch = 16>
+    auto gather(std::span<const size_t> idx, std::span<T> out) const -> void {
+        if (out.size() < idx.size()) throw std::invalid_argument("output buffer smaller than the selection");
+        for_each_indexed<Batch>(idx, [&](size_t k, const aos_view &elem) {
+            consteval {
+                for (auto member : nonstatic_data_members_of(^T)) {
+                    // e.g., out[k].x = elem.x;
+                    queue_injection(^{
+                      out[k].\id(name_of(member)) = elem.\id(name_of(member));
+                    });
+                }
+            }
+        });
+    }
+
+    // Copy the elements selected by idx into a dense SoA, out[k] = (*this)[idx[k]]
+    template <size_t Batch = 16, size_t OutAlignment>
+    auto gather(std::span<const size_t> idx, vector<T, OutAlignment> &out) const -> void {
+        out.allocate(idx.size());
+        for_each_indexed<Batch>(idx, [&](size_t k, const aos_view &elem) {
+            consteval {
+                for (auto member : nonstatic_data_members_of(^T)) {
+                    // e.g., new (&out._x[k]) double(elem.x);
+                    queue_injection(^{
+                      new (&out.\id("_"sv, name_of(member))[k])
+                          typename[:\(type_of(member)):](elem.\id(name_of(member)));
+                    });
+                }
+            }
+        });
+    }
+};
+
+///
+// Alternative layouts of the elements of T, with the element access of vector: size(),
+// operator[] and at<Member>()
+///
+
+// Array of structures
+template <typename T>
+class aos_vector {
+    std::vector<T> elements;
+
+   public:
+    static auto name() -> std::string { return "aos"; }
+
+    aos_vector(std::span<const T> data) : elements(data.begin(), data.end()) {}
+
+    auto size() const -> std::size_t { return elements.size(); }
+
+    auto operator[](std::size_t idx) const -> const T & { return elements[idx]; }
+
+    template <std::meta::info Member>
+    auto at(std::size_t idx) -> typename[:type_of(Member):] & {
+        return elements[idx].[:Member:];
+    }
+};
+
+// Array of structures of arrays: blocks of Block elements holding an array of Block values per
+// member, so that a kernel reading a few members of consecutive elements touches one cache line
+// per member and block
+template <typename T, size_t Block, size_t Alignment>
+class aosoa_vector {
+    struct alignas(Alignment) block {
+        consteval { gen_block_members(^T, Block); }
+    };
+
+    struct aos_view {
+        consteval { gen_sor_members(^T); }
+    };
+
+    std::vector<block> blocks;
+    size_t _size;
+
+   public:
+    static auto name() -> std::string { return "aosoa-" + std::to_string(Block); }
+
+    aosoa_vector(std::span<const T> data)
+        : blocks((data.size() + Block - 1) / Block), _size(data.size()) {
+        for (size_t idx = 0; idx < _size; idx++) {
+            consteval {
+                for (auto member : nonstatic_data_members_of(^T)) {
+                    // e.g., blocks[idx / Block].x[idx % Block] = data[idx].x;
+                    queue_injection(^{
+                      blocks[idx / Block].\id(name_of(member))[idx % Block] =
+                          data[idx].\id(name_of(member));
+                    });
+                }
+            }
+        }
+    }
+
+    auto size() const -> std::size_t { return _size; }
+
+    auto operator[](std::size_t idx) const -> aos_view {
+        consteval {
+            std::meta::list_builder member_data_tokens{};
+            for (auto member : nonstatic_data_members_of(^T)) {
+                member_data_tokens += ^{
+                  .\id(name_of(member)) = blocks[idx / Block].\id(name_of(member))[idx % Block]
+                };
+            }
+
+            // Injects: return aos_view(blocks[idx / Block].x[idx % Block], ...);
+            queue_injection(^{
+              return aos_view{\tokens(member_data_tokens)};
+            });
+        }
+    }
+
+    template <std::meta::info Member>
+    auto at(std::size_t idx) -> typename[:type_of(Member):] & {
+        consteval {
+            // e.g., return blocks[idx / Block].x[idx % Block];
+            queue_injection(^{
+              return blocks[idx / Block].\id(name_of(Member))[idx % Block];
+            });
+        }
+    }
+};
+
+///
+// Layout tuning
+///
+
+// Candidate layouts of T, the first ones being preferred on ties
+template <typename T>
+using layout_variant = std::variant<vector<T, 64>, aosoa_vector<T, 8, 64>, aosoa_vector<T, 16, 64>,
+                                    aosoa_vector<T, 64, 64>, aos_vector<T>>;
+
+// Elements of T in a layout chosen at run time among layout_variant<T>, typically by tune_layout
+template <typename T>
+class tuned_vector {
+    layout_variant<T> layout;
+
+    // Layout I holding data, built without printing its layout
+    template <size_t I>
+    static auto candidate(std::span<const T> data) {
+        using L = std::variant_alternative_t<I, layout_variant<T>>;
+        if constexpr (requires { typename L::quiet_t; })
+            return L(typename L::quiet_t{}, data);
+        else
+            return L(data);
+    }
+
+    // Layout index holding data, checked before any layout is built
+    template <size_t I = 0>
+    static auto make(size_t index, std::span<const T> data) -> layout_variant<T> {
+        if constexpr (I + 1 < n_layouts) {
+            if (index != I) return make<I + 1>(index, data);
+        } else if (index != I) {
+            throw std::out_of_range("no layout " + std::to_string(index));
+        }
+        return layout_variant<T>(std::in_place_index<I>, candidate<I>(data));
+    }
+
+   public:
+    static constexpr size_t n_layouts = std::variant_size_v<layout_variant<T>>;
+
+    static auto layout_name(size_t index) -> std::string {
+        return [&]<size_t... I>(std::index_sequence<I...>) {
+            std::string name;
+            ((index == I ? name = std::variant_alternative_t<I, layout_variant<T>>::name() : name),
+             ...);
+            return name;
+        }(std::make_index_sequence<n_layouts>{});
+    }
+
+    tuned_vector(size_t index, std::span<const T> data) : layout(make(index, data)) {}
+
+    auto layout_index() const -> size_t { return layout.index(); }
+
+    auto size() const -> std::size_t {
+        return std::visit([](auto &elements) { return elements.size(); }, layout);
+    }
+
+    auto operator[](std::size_t idx) const -> T {
+        return std::visit(
+            [&](auto &elements) {
+                const auto &elem = elements[idx];
+                T out;
+                consteval {
+                    for (auto member : nonstatic_data_members_of(^T)) {
+                        // e.g., out.x = elem.x;
+                        queue_injection(^{
+                          out.\id(name_of(member)) = elem.\id(name_of(member));
+                        });
+                    }
+                }
+                return out;
+            },
+            layout);
+    }
+
+    // Call f(elements) on the layout in use. f is instantiated for every layout and dispatched
+    // once per call, so a kernel written against size(), operator[] and at<Member>() runs at the
+    // speed of the layout it is given, e.g.
+    //     tuned.visit([](auto &v) {
+    //         for (size_t i = 0; i < v.size(); i++) v.template at<^data::z>(i) = v[i].x;
+    //     });
+    template <typename F>
+    auto visit(F &&f) -> decltype(auto) {
+        return std::visit(std::forward<F>(f), layout);
+    }
+    template <typename F>
+    auto visit(F &&f) const -> decltype(auto) {
+        return std::visit(std::forward<F>(f), layout);
+    }
+};
+
+// Model name of the CPU, the key of cached layout decisions
+inline auto cpu_model() -> std::string {
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    for (std::string line; std::getline(cpuinfo, line);) {
+        auto colon = line.find(':');
+        if (line.starts_with("model name") && colon != std::string::npos)
+            return line.substr(line.find_first_not_of(" \t", colon + 1));
+    }
+    return "unknown";
+}
+
+// Index of the fastest layout of T for a workload, in tuned_vector<T>. kernel(elements) is the
+// representative work of the workload, run on every candidate layout holding sample; it must have
+// observable effects, such as writes through at<Member>(), so that it is not optimized away. Each
+// candidate runs the kernel once to warm up and is then ranked on its fastest of repeats runs.
+//
+// Decisions are cached per CPU model, type and workload in cache_path, as lines of tab separated
+// CPU model, type, workload and layout name, and reused without running the kernel. The cache is
+// rewritten through a rename, so that processes sharing it never read a partial file; if it cannot
+// be written, the decision is only not cached.
+template <typename T, typename Kernel>
+auto tune_layout(std::string_view workload, std::span<const T> sample, Kernel &&kernel,
+                 const std::string &cache_path, size_t repeats = 5)
+    -> size_t {
+    std::string key = cpu_model() + "\t" + typeid(T).name() + "\t" + std::string(workload) + "\t";
+
+    std::vector<std::string> lines;
+    {
+        std::ifstream cache(cache_path);
+        for (std::string line; std::getline(cache, line);) {
+            if (!line.starts_with(key)) {
+                lines.push_back(line);
+                continue;
+            }
+            // A decision for a layout that is no longer a candidate is dropped
+            for (size_t index = 0; index < tuned_vector<T>::n_layouts; index++)
+                if (line.substr(key.size()) == tuned_vector<T>::layout_name(index)) return index;
+        }
+    }
+
+    size_t best = 0;
+    auto best_time = std::chrono::steady_clock::duration::max();
+    for (size_t index = 0; index < tuned_vector<T>::n_layouts; index++) {
+        tuned_vector<T> candidate(index, sample);
+        candidate.visit(kernel);
+        for (size_t r = 0; r < repeats; r++) {
+            auto start = std::chrono::steady_clock::now();
+            candidate.visit(kernel);
+            auto time = std::chrono::steady_clock::now() - start;
+            if (time < best_time) {
+                best_time = time;
+                best = index;
+            }
+        }
+    }
+
+    lines.push_back(key + tuned_vector<T>::layout_name(best));
+    auto tmp_path = cache_path + "." + std::to_string(getpid());
+    std::ofstream tmp(tmp_path);
+    for (auto &line : lines) tmp << line << "\n";
+    tmp.close();
+    if (!tmp || std::rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+        std::remove(tmp_path.c_str());
+    return best;
+}
+
+///
+// Pipelined loading: chunks of a file of T records are read in the background while the
+// chunks already read are scattered into a vector and processed
+///
+
+// Sequence of values produced lazily by a coroutine, one co_yield per iteration step
+template <typename V>
+class generator {
+   public:
+    struct promise_type {
+        std::optional<V> value;
+        std::exception_ptr error;
+
+        auto get_return_object() -> generator {
+            return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+        auto final_suspend() noexcept -> std::suspend_always { return {}; }
+        auto yield_value(V v) -> std::suspend_always {
+            value = std::move(v);
+            return {};
+        }
+        auto return_void() -> void {}
+        auto unhandled_exception() -> void { error = std::current_exception(); }
+    };
+
+    class iterator {
+        std::coroutine_handle<promise_type> coroutine;
+
+        auto advance() -> void {
+            coroutine.resume();
+            if (coroutine.promise().error) std::rethrow_exception(coroutine.promise().error);
+        }
+       public:
+        explicit iterator(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {
+            advance();
+        }
+
+        auto operator*() const -> const V & { return *coroutine.promise().value; }
+        auto operator++() -> iterator & {
+            advance();
+            return *this;
+        }
+        auto operator==(std::default_sentinel_t) const -> bool { return coroutine.done(); }
+    };
+
+    explicit generator(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+    generator(generator &&other) noexcept : coroutine(std::exchange(other.coroutine, {})) {}
+    generator(const generator &) = delete;
+    ~generator() {
+        if (coroutine) coroutine.destroy();
+    }
+
+    auto begin() -> iterator { return iterator(coroutine); }
+    auto end() -> std::default_sentinel_t { return {}; }
+   private:
+    std::coroutine_handle<promise_type> coroutine;
+};
+
+// Coroutine started eagerly, which may be resumed on another thread, and whose completion get()
+// waits for
+class task {
+   public:
+    struct promise_type {
+        std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+        std::exception_ptr error;
+
+        // Signal completion once suspended for good, so that the waiter may destroy the coroutine.
+        // It may do so as soon as done is set, promise included, so the flag is notified through a
+        // reference of its own.
+        struct completion {
+            auto await_ready() noexcept -> bool { return false; }
+            auto await_suspend(std::coroutine_handle<promise_type> coroutine) noexcept -> void {
+                auto done = coroutine.promise().done;
+                *done = true;
+                done->notify_all();
+            }
+            auto await_resume() noexcept -> void {}
+        };
+
+        auto get_return_object() -> task {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        auto initial_suspend() noexcept -> std::suspend_never { return {}; }
+        auto final_suspend() noexcept -> completion { return {}; }
+        auto return_void() -> void {}
+        auto unhandled_exception() -> void { error = std::current_exception(); }
+    };
+
+    explicit task(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+    task(task &&other) noexcept : coroutine(std::exchange(other.coroutine, {})) {}
+    task(const task &) = delete;
+    ~task() {
+        if (coroutine) {
+            coroutine.promise().done->wait(false);
+            coroutine.destroy();
+        }
+    }
+
+    // Wait for the coroutine to finish, and rethrow what escaped it
+    auto get() -> void {
+        coroutine.promise().done->wait(false);
+        if (coroutine.promise().error) std::rethrow_exception(coroutine.promise().error);
+    }
+   private:
+    std::coroutine_handle<promise_type> coroutine;
+};
+
+// Loads a file of trivially copyable T records into a vector, chunk_size elements at a time. Up to
+// depth chunks are read ahead by a pool of reader threads, each into its own buffer, while the
+// chunks already read are scattered into the storage vectors in order, so that reading,
+// transposing and processing overlap. Chunks are consumed either by co_await load_chunk() from a
+// coroutine, or by iterating over ready(); each returns the index range just loaded.
+template <typename T, size_t Alignment>
+class loader {
+    static_assert(std::is_trivially_copyable_v<T>, "records are read as raw bytes");
+
+    // Read buffer of one of the chunks in flight
+    struct slot {
+        std::vector<std::byte> bytes;
+        bool ready = false;
+        std::exception_ptr error;
+        std::coroutine_handle<> waiter;  // Coroutine to resume once the chunk is read
+    };
+
+    int fd;
+    vector<T, Alignment> _elements;
+    size_t chunk_size;  // Elements per chunk
+    size_t n_chunks;
+    size_t next = 0;       // Next chunk to scatter
+    size_t submitted = 0;  // Chunks queued for reading
+
+    std::vector<slot> slots;   // Chunk c is read into slots[c % slots.size()]
+    std::deque<size_t> queue;  // Chunks to read
+    std::mutex mutex;
+    std::condition_variable wake_reader, wake_consumer;
+    bool stopping = false;
+    std::vector<std::thread> readers;
+
+    static auto check_positive(size_t n, const char *what) -> size_t {
+        if (n == 0) throw std::invalid_argument(std::string(what) + " of a loader must be positive");
+        return n;
+    }
+
+    static auto record_count(int fd) -> size_t {
+        struct stat st;
+        if (fstat(fd, &st) != 0) throw std::system_error(errno, std::generic_category(), "fstat");
+        if (st.st_size % sizeof(T) != 0)
+            throw std::runtime_error("file size is not a multiple of the record size");
+        return st.st_size / sizeof(T);
+    }
+
+    // Queue the reads of the chunks whose slot has been scattered. Called with mutex held.
+    auto submit() -> void {
+        for (; submitted < n_chunks && submitted < next + slots.size(); submitted++) {
+            auto &s = slots[submitted % slots.size()];
+            s.ready = false;
+            s.error = nullptr;
+            queue.push_back(submitted);
+        }
+        wake_reader.notify_all();
+    }
+
+    auto read_chunk(size_t chunk, std::byte *buf) -> void {
+        size_t offset = chunk * chunk_size * sizeof(T);
+        size_t size =
+            (std::min((chunk + 1) * chunk_size, _elements.size()) - chunk * chunk_size) * sizeof(T);
+        while (size > 0) {
+            ssize_t n = pread(fd, buf, size, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw std::system_error(errno, std::generic_category(), "pread");
+            if (n == 0) throw std::runtime_error("unexpected end of file");
+            buf += n;
+            offset += n;
+            size -= n;
+        }
+    }
+
+    auto read_loop() -> void {
+        for (;;) {
+            size_t chunk;
+            {
+                std::unique_lock lock(mutex);
+                wake_reader.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (stopping) return;
+                chunk = queue.front();
+                queue.pop_front();
+            }
+
+            auto &s = slots[chunk % slots.size()];
+            std::exception_ptr error;
+            try {
+                read_chunk(chunk, s.bytes.data());
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            std::coroutine_handle<> waiter;
+            {
+                std::lock_guard lock(mutex);
+                s.ready = true;
+                s.error = error;
+                waiter = std::exchange(s.waiter, {});
+            }
+            wake_consumer.notify_all();
+            // The awaiting coroutine scatters the chunk on this thread, while the other readers
+            // keep reading
+            if (waiter) waiter.resume();
+        }
+    }
+
+    // Scatter the next chunk, which has been read, into the storage vectors and queue the read of
+    // a further one
+    auto scatter_next() -> index_range {
+        auto &s = slots[next % slots.size()];
+        if (s.error) std::rethrow_exception(s.error);
+
+        index_range range{next * chunk_size, std::min((next + 1) * chunk_size, _elements.size())};
+        _elements.scatter(range.begin, std::span(reinterpret_cast<const T *>(s.bytes.data()),
+                                                 range.end - range.begin));
+
+        std::lock_guard lock(mutex);
+        next++;
+        submit();
+        return range;
+    }
+
+   public:
+    loader(int fd, size_t chunk_size = 1 << 16, size_t depth = 4, size_t threads = 2)
+        : fd(fd),
+          _elements(typename vector<T, Alignment>::quiet_t{}, record_count(fd)),
+          chunk_size(check_positive(chunk_size, "chunk size")),
+          n_chunks((_elements.size() + chunk_size - 1) / chunk_size),
+          slots(check_positive(depth, "depth")) {
+        check_positive(threads, "number of threads");
+        for (auto &s : slots) s.bytes.resize(chunk_size * sizeof(T));
+        {
+            std::lock_guard lock(mutex);
+            submit();
+        }
+        for (size_t t = 0; t < threads; t++) readers.emplace_back([this] { read_loop(); });
+    }
+
+    loader(const loader &) = delete;
+    auto operator=(const loader &) -> loader & = delete;
+
+    ~loader() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake_reader.notify_all();
+        for (auto &reader : readers) reader.join();
+    }
+
+    // Vector loaded into. Elements are valid once the index range holding them has been
+    // returned.
+    auto elements() -> vector<T, Alignment> & { return _elements; }
+
+    struct chunk_awaitable {
+        loader &l;
+
+        auto await_ready() -> bool {
+            if (l.next == l.n_chunks) return true;
+            std::lock_guard lock(l.mutex);
+            return l.slots[l.next % l.slots.size()].ready;
+        }
+        // Resumed by the reader thread completing the chunk, unless it completed in the meantime
+        auto await_suspend(std::coroutine_handle<> coroutine) -> bool {
+            std::lock_guard lock(l.mutex);
+            auto &s = l.slots[l.next % l.slots.size()];
+            if (s.ready) return false;
+            s.waiter = coroutine;
+            return true;
+        }
+        auto await_resume() -> std::optional<index_range> {
+            if (l.next == l.n_chunks) return std::nullopt;
+            return l.scatter_next();
+        }
+    };
+
+    // Wait for the next chunk to be read without blocking the thread, then scatter it. Yields
+    // std::nullopt once the whole file is loaded.
+    auto load_chunk() -> chunk_awaitable { return {*this}; }
+
+    // Index ranges of the chunks, each yielded as soon as it is read and scattered
+    auto ready() -> generator<index_range> {
+        while (next < n_chunks) {
+            {
+                std::unique_lock lock(mutex);
+                wake_consumer.wait(lock, [&] { return slots[next % slots.size()].ready; });
+            }
+            co_yield scatter_next();
+        }
+    }
+};
+
+///
+// Concurrent snapshots: readers take consistent views of a vector while a writer keeps updating
+// and appending to it
+///
+
+// Elements in segments of Segment elements, each laid out as one array per member, written by one
+// thread and read through snapshots by any number of others. The writer updates elements with at
+// and appends them with push_back, then makes its changes visible at once with publish. A snapshot
+// pins the last published version, i.e. its size and segments, so that it stays consistent however
+// long it is held.
+//
+// A segment is copied on its first update after a publish, so that published segments are never
+// written where a snapshot may read them; appends go in place, past the published size. Superseded
+// versions and the segments copied away from them are retired with the current epoch, and freed by
+// a later publish once every snapshot is pinned at a later epoch. Taking a snapshot is lock free,
+// and the writer never waits for readers.
+template <typename T, size_t Alignment, size_t Segment = 1024>
+class versioned_vector {
+    struct alignas(Alignment) segment {
+        consteval { gen_block_members(^T, Segment); }
+    };
+
+    struct aos_view {
+        consteval { gen_sor_members(^T); }
+    };
+
+    // What a snapshot sees
+    struct version {
+        size_t size;
+        std::vector<const segment *> segments;
+    };
+
+    // Superseded version and the segments copied away from it, which snapshots pinned at epoch or
+    // before may still read
+    struct retired {
+        uint64_t epoch;
+        const version *superseded;
+        std::vector<segment *> segments;
+    };
+
+    static constexpr uint64_t unpinned = ~uint64_t(0);
+    static constexpr size_t max_snapshots = 64;  // Snapshots alive at once
+
+    // Epoch a snapshot is pinned at, on its own cache line so that readers do not contend
+    struct alignas(64) pin {
+        std::atomic<uint64_t> epoch = unpinned;
+    };
+
+    // Writer state
+    std::vector<segment *> segments;
+    std::vector<bool> owned;  // Segments allocated or copied since the last publish
+    size_t _size = 0;
+    size_t published_size = 0;
+    std::vector<segment *> replaced;  // Segments copied away from since the last publish
+    std::vector<retired> retirees;
+
+    // Shared with readers
+    std::atomic<const version *> published;
+    std::atomic<uint64_t> epoch = 0;
+    mutable std::array<pin, max_snapshots> pins;
+
+    // Element idx of a segment as an aos_view
+    static auto view(const segment &seg, std::size_t idx) -> aos_view {
+        consteval {
+            std::meta::list_builder member_data_tokens{};
+            for (auto member : nonstatic_data_members_of(^T)) {
+                member_data_tokens += ^{
+                  .\id(name_of(member)) = seg.\id(name_of(member))[idx % Segment]
+                };
+            }
+
+            // Injects: return aos_view(seg.x[idx % Segment], ...);
+            queue_injection(^{
+              return aos_view{\tokens(member_data_tokens)};
+            });
+        }
+    }
+
+    // Segment of element idx, copied first if a snapshot may read element idx in it
+    auto writable(size_t idx) -> segment & {
+        size_t s = idx / Segment;
+        if (!owned[s] && idx < published_size) {
+            replaced.push_back(segments[s]);
+            segments[s] = new segment(*segments[s]);
+            owned[s] = true;
+        }
+        return *segments[s];
+    }
+
+    // Free what no snapshot can read anymore
+    auto reclaim() -> void {
+        uint64_t oldest = unpinned;
+        for (auto &p : pins) oldest = std::min(oldest, p.epoch.load());
+        std::erase_if(retirees, [&](const retired &r) {
+            if (r.epoch >= oldest) return false;
+            release(r);
+            return true;
+        });
+    }
+
+    static auto release(const retired &r) -> void {
+        delete r.superseded;
+        for (auto s : r.segments) delete s;
+    }
+
+   public:
+    // Consistent, immutable view of the elements of a versioned_vector at a publish. Must not
+    // outlive the vector.
+    class snapshot_view {
+        std::atomic<uint64_t> *pinned;
+        const version *v;
+
+       public:
+        snapshot_view(std::atomic<uint64_t> *pinned, const version *v) : pinned(pinned), v(v) {}
+        snapshot_view(snapshot_view &&other) noexcept
+            : pinned(std::exchange(other.pinned, nullptr)), v(other.v) {}
+        snapshot_view(const snapshot_view &) = delete;
+        auto operator=(const snapshot_view &) -> snapshot_view & = delete;
+
+        ~snapshot_view() {
+            if (pinned) pinned->store(unpinned, std::memory_order_release);
+        }
+
+        auto size() const -> std::size_t { return v->size; }
+
+        auto operator[](std::size_t idx) const -> aos_view {
+            return view(*v->segments[idx / Segment], idx);
+        }
+
+        auto n_segments() const -> size_t { return (v->size + Segment - 1) / Segment; }
+
+        // Column expression leaf over the values of a member in segment s, e.g.
+        //     mds::reduce(snap.col<^data::x>(s) * snap.col<^data::y>(s), 0.0)
+        template <std::meta::info Member>
+        auto col(size_t s) const -> column<const typename[:type_of(Member):]> {
+            size_t n = std::min(Segment, v->size - s * Segment);
+            consteval {
+                // e.g., return {v->segments[s]->x, n};
+                queue_injection(^{
+                  return {v->segments[s]->\id(name_of(Member)), n};
+                });
+            }
+        }
+
+        // Fold all values of a member, e.g. reduce<^data::x>(std::plus<>{}) is their sum
+        template <std::meta::info Member, typename Op = std::plus<>>
+            requires(!std::is_arithmetic_v<Op>)
+        auto reduce(Op op = {}) const -> typename[:type_of(Member):] {
+            using S = typename[:type_of(Member):];
+            if (size() == 0) return {};
+            auto first = col<Member>(0);
+            S result = mds::reduce(column<const S>(first.data + 1, first.size() - 1), first[0], op);
+            for (size_t s = 1; s < n_segments(); s++)
+                result = mds::reduce(col<Member>(s), result, op);
+            return result;
+        }
+
+        // Fold all values of a member onto init, e.g. reduce<^data::x>(0.0) is their sum
+        template <std::meta::info Member, typename U, typename Op = std::plus<>>
+            requires(std::is_arithmetic_v<U>)
+        auto reduce(U init, Op op = {}) const -> U {
+            for (size_t s = 0; s < n_segments(); s++)
+                init = mds::reduce(col<Member>(s), init, op);
+            return init;
+        }
+    };
+
+    static auto name() -> std::string { return "versioned-" + std::to_string(Segment); }
+
+    versioned_vector(std::span<const T> data = {}) : published(new version{0, {}}) {
+        for (auto &elem : data) push_back(elem);
+        publish();
+    }
+
+    versioned_vector(const versioned_vector &) = delete;
+    auto operator=(const versioned_vector &) -> versioned_vector & = delete;
+
+    ~versioned_vector() {
+        delete published.load();
+        for (auto &r : retirees) release(r);
+        for (auto s : replaced) delete s;
+        for (auto s : segments) delete s;
+    }
+
+    // Number of elements of the writer, published or not
+    auto size() const -> std::size_t { return _size; }
+
+    // Element idx as the writer sees it
+    auto operator[](std::size_t idx) const -> aos_view {
+        return view(*segments[idx / Segment], idx);
+    }
+
+    // Mutable value of a member of element idx, visible to snapshots taken after the next publish
+    template <std::meta::info Member>
+    auto at(std::size_t idx) -> typename[:type_of(Member):] & {
+        auto &seg = writable(idx);
+        consteval {
+            // e.g., return seg.x[idx % Segment];
+            queue_injection(^{
+              return seg.\id(name_of(Member))[idx % Segment];
+            });
+        }
+    }
+
+    // Append an element, visible to snapshots taken after the next publish
+    auto push_back(const T &elem) -> void {
+        if (_size == segments.size() * Segment) {
+            segments.push_back(new segment{});
+            owned.push_back(true);
+        }
+        auto &seg = *segments[_size / Segment];
+        consteval {
+            for (auto member : nonstatic_data_members_of(^T)) {
+                // e.g., seg.x[_size % Segment] = elem.x;
+                queue_injection(^{
+                  seg.\id(name_of(member))[_size % Segment] = elem.\id(name_of(member));
+                });
+            }
+        }
+        _size++;
+    }
+
+    // Make the updates and appends made so far visible to new snapshots, and free what old ones no
+    // longer pin
+    auto publish() -> void {
+        auto superseded =
+            published.exchange(new version{_size, {segments.begin(), segments.end()}});
+        retirees.push_back({epoch.fetch_add(1), superseded, std::move(replaced)});
+        replaced.clear();
+        std::fill(owned.begin(), owned.end(), false);
+        published_size = _size;
+        reclaim();
+    }
+
+    // Pin the last published version. Lock free; throws std::runtime_error if max_snapshots
+    // snapshots are alive.
+    auto snapshot() const -> snapshot_view {
+        size_t first = std::hash<std::thread::id>{}(std::this_thread::get_id());
+        for (size_t k = 0; k < max_snapshots; k++) {
+            auto &p = pins[(first + k) % max_snapshots];
+            uint64_t idle = unpinned;
+            if (p.epoch.compare_exchange_strong(idle, epoch.load()))
+                return snapshot_view(&p.epoch, published.load());
+        }
+        throw std::runtime_error("too many snapshots");
+    }
 };
 }  // namespace mds
 
@@ -178,5 +1614,148 @@ int main() {
         std::cout << "})\n";
     }
 
+    // Random access through a lookup table
+    std::vector<size_t> lookup = {2, 0, 2};
+
+    std::vector<data> aos(lookup.size());
+    maos.gather(lookup, aos);
+
+    mds::vector<data, 64> soa = {};
+    maos.gather(lookup, soa);
+
+    std::cout << "\ngathered " << soa.size() << " elements\n";
+    for (size_t i = 0; i != soa.size(); ++i) {
+        std::cout << "aos[" << i << "] = ({";
+        consteval {
+            for (auto member : nonstatic_data_members_of(^data)) {
+                queue_injection(^{
+                  std::cout << \(name_of(member)) << ": " << aos[i].\id(name_of(member)) << ", ";
+                });
+            }
+        }
+        std::cout << "})\tsoa[" << i << "] = ({";
+        consteval {
+            for (auto member : nonstatic_data_members_of(^data)) {
+                queue_injection(^{
+                  std::cout << \(name_of(member)) << ": " << soa[i].\id(name_of(member)) << ", ";
+                });
+            }
+        }
+        std::cout << "})\n";
+    }
+
+    // Fused column arithmetic
+    maos.col<^data::value>() = maos.col<^data::x>() * 2 + maos.col<^data::y>();
+    std::cout << "\nvalue = x * 2 + y\n";
+    for (size_t i = 0; i != maos.size(); ++i)
+        std::cout << "maos[" << i << "].value = " << maos[i].value << "\n";
+    std::cout << "sum(x * y) = " << mds::reduce(maos.col<^data::x>() * maos.col<^data::y>(), 0.0)
+              << "\n";
+
+    // Reductions and aggregations
+    std::cout << "\nmax(z) = "
+              << maos.reduce<^data::z>([](double a, double b) { return std::max(a, b); }) << "\n";
+    std::cout << "sum(z) = " << maos.reduce<^data::z>(0.0) << "\n";
+    auto [x, y] = maos.summarize<^data::x, ^data::y>();
+    std::cout << "x: mean " << x.mean << ", variance " << x.variance() << "\ty: min " << y.min
+              << ", max " << y.max << "\n";
+
+    auto by_y = soa.group_by<^data::y>();
+    auto sums = by_y.aggregate<^data::value>(0.0, std::plus<>{});
+    auto stats = by_y.aggregate<^data::x>();
+    for (size_t g = 0; g != by_y.keys.size(); ++g)
+        std::cout << "y = " << by_y.keys[g] << ": sum(value) = " << sums[g]
+                  << ", count = " << stats[g].count << ", mean(x) = " << stats[g].mean << "\n";
+
+    // Spatial ordering and queries
+    auto index = maos.spatial_index<^data::x, ^data::y, ^data::z>(2);
+    std::cout << "\nMorton order:";
+    for (size_t i = 0; i != maos.size(); ++i)
+        std::cout << " (" << maos[i].x << ", " << maos[i].y << ", " << maos[i].z << ")";
+    std::cout << "\n";
+    for (auto [begin, end] : index.box({3, 4, 5}, {9, 10, 11}))
+        std::cout << "box [3, 9] x [4, 10] x [5, 11] -> [" << begin << ", " << end << ")\n";
+    for (auto [begin, end] : index.radius({0, 1, 2}, 1))
+        std::cout << "radius 1 around (0, 1, 2) -> [" << begin << ", " << end << ")\n";
+
+    // Layout tuning, against a kernel written once for every layout
+    std::vector<data> sample(4096);
+    for (size_t i = 0; i != sample.size(); ++i)
+        sample[i] = {double(i), double(i % 7), double(i % 13), 0};
+    auto kernel = [](auto &elements) {
+        for (size_t i = 0; i != elements.size(); ++i)
+            elements.template at<^data::value>(i) = elements[i].x * 2 + elements[i].y;
+    };
+
+    auto cache_path = std::filesystem::temp_directory_path() /
+                      ("mds_layouts." + std::to_string(getpid()) + ".tsv");
+    auto layout = mds::tune_layout<data>("value = x * 2 + y", sample, kernel, cache_path.string());
+    std::filesystem::remove(cache_path);
+    mds::tuned_vector<data> tuned(layout, sample);
+    tuned.visit(kernel);
+    std::cout << "\nlayout for value = x * 2 + y on " << mds::cpu_model() << ": "
+              << mds::tuned_vector<data>::layout_name(layout) << ", value[5] = " << tuned[5].value
+              << "\n";
+
+    // Pipelined loading of a file of records
+    int fd = memfd_create("mds_records", 0);
+    if (fd < 0 || write(fd, sample.data(), sample.size() * sizeof(data)) < 0) return 1;
+    {
+        mds::loader<data, 64> loader(fd, 1024);
+        double sum = 0;
+        for (auto [begin, end] : loader.ready())
+            for (size_t i = begin; i != end; ++i) sum += loader.elements()[i].x;
+        std::cout << "\nloaded " << loader.elements().size() << " elements, sum(x) = " << sum
+                  << "\n";
+    }
+    {
+        mds::loader<data, 64> loader(fd, 1024);
+        size_t chunks = 0;
+        auto consume = [&]() -> mds::task {
+            while (auto range = co_await loader.load_chunk()) chunks++;
+        };
+        consume().get();
+        std::cout << "loaded " << loader.elements().size() << " elements in " << chunks
+                  << " chunks from a coroutine\n";
+    }
+    close(fd);
+
+    // Consistent snapshots for concurrent readers
+    mds::versioned_vector<data, 64> live(sample);
+    for (size_t i = 0; i != live.size(); ++i)
+        live.at<^data::value>(i) = live[i].x * 2 + live[i].y;
+    live.publish();
+
+    std::atomic<bool> ingesting = true;
+    std::atomic<size_t> inconsistent = 0;
+    std::thread analyst([&] {
+        size_t last_size = 0;
+        do {
+            auto snap = live.snapshot();
+            for (size_t i = 0; i != snap.size(); ++i)
+                if (snap[i].value != snap[i].x * 2 + snap[i].y) inconsistent++;
+            if (snap.size() < last_size) inconsistent++;
+            last_size = snap.size();
+        } while (ingesting);
+    });
+    for (size_t round = 0; round != 16; ++round) {
+        for (size_t i = 0; i != 256; ++i) {
+            double x = live.size();
+            live.push_back({x, double(i % 7), 0, x * 2 + i % 7});
+        }
+        for (size_t i = round; i < live.size(); i += 97) {
+            live.at<^data::x>(i) += 1;
+            live.at<^data::value>(i) += 2;
+        }
+        live.publish();
+    }
+    ingesting = false;
+    analyst.join();
+
+    auto snap = live.snapshot();
+    std::cout << "\nsnapshot of " << snap.size()
+              << " elements, sum(value) = " << snap.reduce<^data::value>(0.0)
+              << ", inconsistent reads: " << inconsistent << "\n";
+
     return 0;
 }
@@ -3,11 +3,31 @@
 // container.
 // Run here: https://godbolt.org/z/P613hh8MG
 
+#include <algorithm>
+#include <bit>
+#include <cerrno>
 #include <concepts>
+#include <cstdint>
+#include <cstring>
 #include <experimental/meta>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std::literals::string_view_literals;
 
@@ -80,6 +100,57 @@ template <typename T> void print_container_addr(T &v) {
   std::cout << "}\n";
 }
 
+///
+// Arrow C data interface, https://arrow.apache.org/docs/format/CDataInterface.html
+///
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  // Array type description
+  const char *format;
+  const char *name;
+  const char *metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema **children;
+  struct ArrowSchema *dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowSchema *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+struct ArrowArray {
+  // Array data description
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void **buffers;
+  struct ArrowArray **children;
+  struct ArrowArray *dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowArray *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+// Whether r is a std::optional, which marks a nullable member
+consteval auto type_is_optional(std::meta::info r) -> bool {
+  return has_template_arguments(r) && template_of(r) == ^std::optional;
+}
+
 ///
 // Magic Data Structure
 ///
@@ -88,9 +159,111 @@ consteval auto get_scalar_type(std::meta::info t) -> std::meta::info {
   if (type_is_container(t)) {
     return get_scalar_type(template_arguments_of(t)[0]);
   }
+  if (type_is_optional(t)) {
+    return template_arguments_of(t)[0];
+  }
   return t;
 }
 
+// Fold a span, spread over independent accumulators so the loop vectorizes, which assumes op is associative and
+// commutative
+template <size_t Lanes = 8, typename S, typename U, typename Op = std::plus<>>
+auto reduce(std::span<S> s, U init, Op op = {}) -> U {
+  size_t n = s.size();
+  size_t i = 0;
+  if (n >= Lanes) {
+    U acc[Lanes];
+    for (size_t l = 0; l < Lanes; l++)
+      acc[l] = s[l];
+    for (i = Lanes; i + Lanes <= n; i += Lanes)
+      for (size_t l = 0; l < Lanes; l++)
+        acc[l] = op(acc[l], s[i + l]);
+    for (size_t l = 0; l < Lanes; l++)
+      init = op(init, acc[l]);
+  }
+  for (; i < n; i++)
+    init = op(init, s[i]);
+  return init;
+}
+
+///
+// Nullable members, stored as a dense column of values and a validity bitmap
+///
+
+// Number of 64-bit words of a validity bitmap of n elements
+constexpr auto bitmap_words(size_t n) -> size_t { return (n + 63) / 64; }
+
+// Bit i of a validity bitmap, least significant bit first as in Arrow
+inline auto test_bit(std::span<const uint64_t> bits, size_t i) -> bool { return bits[i / 64] >> (i % 64) & 1; }
+
+// Read only, optional-like reference to the value of a nullable member
+template <typename U> class nullable_ref {
+  const U *_value;
+  bool _valid;
+
+public:
+  nullable_ref(const U &value, bool valid) : _value(&value), _valid(valid) {}
+
+  auto has_value() const -> bool { return _valid; }
+  explicit operator bool() const { return _valid; }
+  auto operator*() const -> const U & { return *_value; }
+  auto operator->() const -> const U * { return _value; }
+
+  auto value() const -> const U & {
+    if (!_valid)
+      throw std::bad_optional_access();
+    return *_value;
+  }
+  template <typename V> auto value_or(V &&other) const -> U {
+    return _valid ? *_value : static_cast<U>(std::forward<V>(other));
+  }
+
+  operator std::optional<U>() const { return _valid ? std::optional<U>(*_value) : std::nullopt; }
+
+  friend std::ostream &operator<<(std::ostream &os, const nullable_ref &obj) {
+    return obj._valid ? os << *obj._value : os << "null";
+  }
+};
+
+// Optional-like reference to the value of a nullable member and to its validity bit, through which it is assigned
+template <typename U> class nullable_mut_ref {
+  U *_value;
+  uint64_t *_word;
+  uint64_t _mask;
+
+public:
+  nullable_mut_ref(U &value, uint64_t &word, size_t bit) : _value(&value), _word(&word), _mask(uint64_t(1) << bit) {}
+
+  auto has_value() const -> bool { return *_word & _mask; }
+  explicit operator bool() const { return has_value(); }
+  auto operator*() const -> U & { return *_value; }
+  auto operator->() const -> U * { return _value; }
+
+  auto value() const -> U & {
+    if (!has_value())
+      throw std::bad_optional_access();
+    return *_value;
+  }
+  template <typename V> auto value_or(V &&other) const -> U {
+    return has_value() ? *_value : static_cast<U>(std::forward<V>(other));
+  }
+
+  operator std::optional<U>() const { return has_value() ? std::optional<U>(*_value) : std::nullopt; }
+
+  auto operator=(const std::optional<U> &other) -> nullable_mut_ref & {
+    *_value = other.value_or(U{});
+    if (other)
+      *_word |= _mask;
+    else
+      *_word &= ~_mask;
+    return *this;
+  }
+
+  friend std::ostream &operator<<(std::ostream &os, const nullable_mut_ref &obj) {
+    return obj.has_value() ? os << *obj._value : os << "null";
+  }
+};
+
 consteval auto gen_sov_members(std::meta::info t) -> void {
   for (auto member : nonstatic_data_members_of(t)) {
     auto vec_member = ^{
@@ -103,6 +276,11 @@ consteval auto gen_sov_members(std::meta::info t) -> void {
         std::vector<sov_metadata> \id("_"sv, name_of(member), "_md"sv);
       });
     }
+    if (type_is_optional(type_of(member))) {
+      queue_injection(^{
+        std::span<uint64_t> \id("_"sv, name_of(member), "_valid"sv);
+      });
+    }
 
     queue_injection(^{
       std::span<typename[:\(type):]> \tokens(vec_member);
@@ -114,7 +292,11 @@ consteval auto gen_sor_members(std::meta::info t) -> void {
   for (auto member : nonstatic_data_members_of(t)) {
     if (type_is_container(type_of(member))) {
       queue_injection(^{
-        const std::span<typename[:\(get_scalar_type(type_of(member))):]>  \id(name_of(member));
+        const std::span<const typename[:\(get_scalar_type(type_of(member))):]>  \id(name_of(member));
+      });
+    } else if (type_is_optional(type_of(member))) {
+      queue_injection(^{
+        const nullable_ref<typename[:\(get_scalar_type(type_of(member))):]> \id(name_of(member));
       });
     } else {
       queue_injection(^{
@@ -124,10 +306,550 @@ consteval auto gen_sor_members(std::meta::info t) -> void {
   }
 }
 
+// Same members as gen_sor_members, through which the element is written
+consteval auto gen_aos_ref_members(std::meta::info t) -> void {
+  for (auto member : nonstatic_data_members_of(t)) {
+    if (type_is_container(type_of(member))) {
+      queue_injection(^{
+        std::span<typename[:\(get_scalar_type(type_of(member))):]>  \id(name_of(member));
+      });
+    } else if (type_is_optional(type_of(member))) {
+      queue_injection(^{
+        nullable_mut_ref<typename[:\(get_scalar_type(type_of(member))):]> \id(name_of(member));
+      });
+    } else {
+      queue_injection(^{
+        typename[:\(type_of(member)):] & \id(name_of(member));
+      });
+    }
+  }
+}
+
+// Injects the return of the aos_view of element m_idx out of the storage vectors in scope, or of its aos_ref if
+// mutable_ref
+consteval auto gen_aos_view(std::meta::info t, bool mutable_ref = false) -> void {
+  // gather references to sov elements
+  std::meta::list_builder member_data_tokens{};
+  for (auto member : nonstatic_data_members_of(t)) {
+    auto name = name_of(member);
+    auto sov_name = ^{
+      \id("_"sv, name)
+    };
+
+    if (type_is_container(type_of(member))) {
+      auto md_name = ^{
+        \id("_"sv, name, "_md"sv)
+      };
+      member_data_tokens += ^{
+        .\id(name) = \tokens(sov_name).subspan(\tokens(md_name)[m_idx].offset, \tokens(md_name)[m_idx].size)
+      };
+    } else if (type_is_optional(type_of(member))) {
+      auto valid_name = ^{
+        \id("_"sv, name, "_valid"sv)
+      };
+      if (mutable_ref) {
+        member_data_tokens += ^{
+          .\id(name) = {\tokens(sov_name)[m_idx], \tokens(valid_name)[m_idx / 64], m_idx % 64}
+        };
+      } else {
+        member_data_tokens += ^{
+          .\id(name) = {\tokens(sov_name)[m_idx], test_bit(\tokens(valid_name), m_idx)}
+        };
+      }
+    } else {
+      member_data_tokens += ^{
+        .\id(name) = \tokens(sov_name)[m_idx]
+      };
+    }
+  }
+
+  // Injects:
+  //     return aos_view(.x = _x[idx], .v = _v.subspan(_v_md[idx].offset, _v_md[idx].size),
+  //                     .w = {_w[idx], test_bit(_w_valid, idx)});
+  if (mutable_ref) {
+    queue_injection(^{
+      return aos_ref{\tokens(member_data_tokens)};
+    });
+  } else {
+    queue_injection(^{
+      return aos_view{\tokens(member_data_tokens)};
+    });
+  }
+}
+
+// Same storage vectors as gen_sov_members, read only, with the metadata of jagged ones and the validity bitmap of
+// nullable ones referring to an image instead of owning it
+consteval auto gen_shared_view_members(std::meta::info t) -> void {
+  for (auto member : nonstatic_data_members_of(t)) {
+    auto type = get_scalar_type(type_of(member));
+    if (type_is_container(type_of(member))) {
+      queue_injection(^{
+        std::span<const sov_metadata> \id("_"sv, name_of(member), "_md"sv);
+      });
+    }
+    if (type_is_optional(type_of(member))) {
+      queue_injection(^{
+        std::span<const uint64_t> \id("_"sv, name_of(member), "_valid"sv);
+      });
+    }
+
+    queue_injection(^{
+      std::span<const typename[:\(type):]> \id("_"sv, name_of(member));
+    });
+  }
+}
+
+// Same storage vectors as gen_sov_members, with the metadata of jagged ones read from Arrow list offsets and the
+// validity bitmap of nullable ones from the Arrow validity buffer
+consteval auto gen_arrow_view_members(std::meta::info t) -> void {
+  for (auto member : nonstatic_data_members_of(t)) {
+    auto type = get_scalar_type(type_of(member));
+    if (type_is_container(type_of(member))) {
+      queue_injection(^{
+        arrow_offsets \id("_"sv, name_of(member), "_md"sv);
+      });
+    }
+    if (type_is_optional(type_of(member))) {
+      queue_injection(^{
+        arrow_bitmap \id("_"sv, name_of(member), "_valid"sv);
+      });
+    }
+
+    queue_injection(^{
+      std::span<typename[:\(type):]> \id("_"sv, name_of(member));
+    });
+  }
+}
+
+///
+// Arrow export helpers. Every exported schema and array owns its strings, buffer list and children through its
+// private_data, so that a consumer can move children out and release them independently, as the C data interface
+// allows.
+///
+
+// Arrow format string of a scalar type
+template <typename S> constexpr auto arrow_format() -> const char * {
+  if constexpr (std::is_same_v<S, float>) {
+    return "f";
+  } else if constexpr (std::is_same_v<S, double>) {
+    return "g";
+  } else {
+    static_assert(std::is_integral_v<S> && !std::is_same_v<S, bool>, "no Arrow format for this type");
+    constexpr const char *formats[2][4] = {{"C", "S", "I", "L"}, {"c", "s", "i", "l"}};
+    return formats[std::is_signed_v<S>][std::bit_width(sizeof(S)) - 1];
+  }
+}
+
+struct arrow_schema_data {
+  std::string format, name;
+  std::vector<ArrowSchema> children;
+  std::vector<ArrowSchema *> child_ptrs;
+};
+
+struct arrow_array_data {
+  std::vector<const void *> buffers;
+  std::vector<int64_t> offsets; // List offsets, exported as buffers[1]
+  std::vector<ArrowArray> children;
+  std::vector<ArrowArray *> child_ptrs;
+};
+
+inline auto release_arrow_schema(ArrowSchema *schema) -> void {
+  auto data = static_cast<arrow_schema_data *>(schema->private_data);
+  for (auto &child : data->children)
+    if (child.release)
+      child.release(&child);
+  delete data;
+  schema->release = nullptr;
+}
+
+inline auto release_arrow_array(ArrowArray *array) -> void {
+  auto data = static_cast<arrow_array_data *>(array->private_data);
+  for (auto &child : data->children)
+    if (child.release)
+      child.release(&child);
+  delete data;
+  array->release = nullptr;
+}
+
+inline auto make_arrow_schema(std::string format, std::string name, std::vector<ArrowSchema> children = {},
+                              int64_t flags = 0) -> ArrowSchema {
+  auto data = new arrow_schema_data{std::move(format), std::move(name), std::move(children), {}};
+  for (auto &child : data->children)
+    data->child_ptrs.push_back(&child);
+  return {.format = data->format.c_str(),
+          .name = data->name.c_str(),
+          .metadata = nullptr,
+          .flags = flags,
+          .n_children = static_cast<int64_t>(data->children.size()),
+          .children = data->child_ptrs.data(),
+          .dictionary = nullptr,
+          .release = release_arrow_schema,
+          .private_data = data};
+}
+
+// Array without nulls over borrowed buffers. The offsets of a list array are given separately, and owned by it.
+inline auto make_arrow_array(size_t length, std::vector<const void *> buffers, std::vector<ArrowArray> children = {},
+                             std::vector<int64_t> offsets = {}) -> ArrowArray {
+  auto data = new arrow_array_data{std::move(buffers), std::move(offsets), std::move(children), {}};
+  if (!data->offsets.empty())
+    data->buffers[1] = data->offsets.data();
+  for (auto &child : data->children)
+    data->child_ptrs.push_back(&child);
+  return {.length = static_cast<int64_t>(length),
+          .null_count = 0,
+          .offset = 0,
+          .n_buffers = static_cast<int64_t>(data->buffers.size()),
+          .n_children = static_cast<int64_t>(data->children.size()),
+          .buffers = data->buffers.data(),
+          .children = data->child_ptrs.data(),
+          .dictionary = nullptr,
+          .release = release_arrow_array,
+          .private_data = data};
+}
+
+// Number of nulls of an imported Arrow array, counted from its validity bitmap when the producer left it unknown (-1)
+inline auto arrow_null_count(const ArrowArray *array) -> int64_t {
+  if (array->null_count >= 0)
+    return array->null_count;
+  auto bits = array->n_buffers > 0 ? static_cast<const uint8_t *>(array->buffers[0]) : nullptr;
+  int64_t nulls = 0;
+  for (int64_t i = array->offset; bits && i < array->offset + array->length; i++)
+    nulls += !(bits[i / 8] >> (i % 8) & 1);
+  return nulls;
+}
+
+// Throw unless an imported Arrow field has the expected format, and no nulls unless nullable
+inline auto check_arrow_field(const ArrowSchema *schema, const ArrowArray *array, std::string_view format,
+                              bool nullable = false) -> void {
+  if (schema->format != format)
+    throw std::runtime_error("unexpected Arrow format " + std::string(schema->format) + " for field " +
+                             std::string(schema->name ? schema->name : "") + ", expected " + std::string(format));
+  if (!nullable && arrow_null_count(array) != 0)
+    throw std::runtime_error("Arrow field " + std::string(schema->name ? schema->name : "") + " has nulls");
+}
+
+// Throw unless an imported Arrow array holds at least length slots past its offset, and a data buffer if it needs one
+inline auto check_arrow_length(const ArrowSchema *schema, const ArrowArray *array, int64_t length) -> void {
+  if (array->offset < 0 || array->length < length || (length > 0 && (array->n_buffers < 2 || !array->buffers[1])))
+    throw std::runtime_error("Arrow field " + std::string(schema->name ? schema->name : "") +
+                             " is too short or has no data");
+}
+
+// Throw unless an imported Arrow list field has a child for its values
+inline auto check_arrow_list(const ArrowSchema *schema, const ArrowArray *array) -> void {
+  if (schema->n_children < 1 || array->n_children < 1)
+    throw std::runtime_error("Arrow list field " + std::string(schema->name ? schema->name : "") + " has no values");
+}
+
+// Validity bitmap of an imported Arrow array, starting at bit offset. A missing bitmap means no nulls.
+struct arrow_bitmap {
+  const uint8_t *bits = nullptr;
+  size_t offset = 0;
+};
+
+inline auto test_bit(const arrow_bitmap &bitmap, size_t i) -> bool {
+  return !bitmap.bits || bitmap.bits[(bitmap.offset + i) / 8] >> ((bitmap.offset + i) % 8) & 1;
+}
+
+///
+// Write tracking
+///
+
+// Granules of a storage vector written since it was last flushed, one bit per granule
+class dirty_bitmap {
+  std::vector<uint64_t> bits;
+  size_t byte_size = 0;
+  size_t n_granules = 0;
+  size_t shift = 0; // log2 of the granule size in bytes
+
+public:
+  dirty_bitmap() = default;
+  dirty_bitmap(size_t byte_size, size_t granule)
+      : byte_size(byte_size), n_granules((byte_size + granule - 1) / granule), shift(std::countr_zero(granule)) {
+    bits.assign(bitmap_words(n_granules), 0);
+  }
+
+  // Mark the granules overlapping size bytes at offset
+  auto mark(size_t offset, size_t size) -> void {
+    if (size == 0)
+      return;
+    for (size_t g = offset >> shift; g <= (offset + size - 1) >> shift; g++)
+      bits[g / 64] |= uint64_t(1) << (g % 64);
+  }
+
+  auto clear() -> void { std::fill(bits.begin(), bits.end(), 0); }
+
+  // Call f(offset, size) for every run of consecutive dirty granules, in bytes. Words without dirty granules are
+  // skipped whole, so a mostly clean bitmap is scanned at 64 granules per step.
+  template <typename F> auto for_each_range(F &&f) const -> void {
+    size_t g = 0;
+    while (g < n_granules) {
+      uint64_t dirty = bits[g / 64] >> (g % 64);
+      if (!dirty) {
+        g = (g / 64 + 1) * 64;
+        continue;
+      }
+      g += std::countr_zero(dirty);
+
+      size_t first = g;
+      while (g < n_granules) {
+        uint64_t clean = ~bits[g / 64] >> (g % 64);
+        if (clean) {
+          g += std::countr_zero(clean);
+          break;
+        }
+        g = (g / 64 + 1) * 64;
+      }
+      g = std::min(g, n_granules);
+      f(first << shift, std::min(g << shift, byte_size) - (first << shift));
+    }
+  }
+};
+
+// Write all of buf at offset in the file behind fd
+inline auto pwrite_all(int fd, const std::byte *buf, size_t size, size_t offset) -> void {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, buf, size, offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::system_error(errno, std::generic_category(), "pwrite");
+    }
+    buf += written;
+    size -= written;
+    offset += written;
+  }
+}
+
+///
+// Runtime described columns, for fields only known at run time, e.g. read from the header of a file. They are laid out
+// like storage vectors, back to back in one block of aligned storage.
+///
+
+// Scalar type of a runtime described column
+enum class scalar_type : uint8_t { i8, i16, i32, i64, u8, u16, u32, u64, f32, f64 };
+
+// Scalar type of the columns of scalars S
+template <typename S> constexpr auto scalar_type_of() -> scalar_type {
+  if constexpr (std::is_same_v<S, float>) {
+    return scalar_type::f32;
+  } else if constexpr (std::is_same_v<S, double>) {
+    return scalar_type::f64;
+  } else {
+    static_assert(std::is_integral_v<S> && !std::is_same_v<S, bool>, "not a scalar type of a column");
+    constexpr scalar_type types[2][4] = {{scalar_type::u8, scalar_type::u16, scalar_type::u32, scalar_type::u64},
+                                         {scalar_type::i8, scalar_type::i16, scalar_type::i32, scalar_type::i64}};
+    return types[std::is_signed_v<S>][std::bit_width(sizeof(S)) - 1];
+  }
+}
+
+// Bytes of a scalar of a column
+constexpr auto scalar_size(scalar_type type) -> size_t {
+  constexpr size_t sizes[] = {1, 2, 4, 8, 1, 2, 4, 8, 4, 8};
+  return sizes[static_cast<size_t>(type)];
+}
+
+// Name, scalar type and shape of a runtime described column
+struct column_desc {
+  std::string name;
+  scalar_type type;
+  bool jagged = false;
+  std::vector<size_t> lengths = {}; // Number of scalars of every element of a jagged column
+};
+
+// Handles of a column of scalars S, resolved once by name with column_set::find and find_jagged
+template <typename S> struct column_handle {
+  size_t index;
+};
+
+template <typename S> struct jagged_column_handle {
+  size_t index;
+};
+
+// Layout of runtime described columns over a block of storage, which is not owned. Fixed columns hold one scalar per
+// element, jagged ones the payloads of the elements back to back, located by a prefix sum of their lengths.
+template <size_t Alignment> class column_set {
+  template <size_t> friend class column_set;
+
+  struct column_layout {
+    std::string name;
+    scalar_type type;
+    bool jagged;
+    size_t offset, size;         // Offset in bytes from the start of the block, size in scalars
+    std::vector<size_t> offsets; // Offset of the payload of every element of a jagged column, and its end
+  };
+
+  std::vector<column_layout> _columns;
+  size_t _size = 0; // Number of elements
+  size_t _byte_size = 0;
+  std::byte *base = nullptr;
+
+  static constexpr size_t align_size(size_t size, size_t alignment) {
+    return ((size + alignment - 1) / alignment) * alignment;
+  }
+
+  auto index_of(std::string_view name, scalar_type type, bool jagged) const -> size_t {
+    for (size_t c_idx = 0; c_idx < _columns.size(); c_idx++) {
+      auto &col = _columns[c_idx];
+      if (col.name != name)
+        continue;
+      if (col.type != type || col.jagged != jagged)
+        throw std::invalid_argument("column " + col.name + " has another type");
+      return c_idx;
+    }
+    throw std::invalid_argument("no column " + std::string(name));
+  }
+
+public:
+  column_set() = default;
+
+  // Lay out the columns of schema for size elements. The block is attached with bind.
+  column_set(std::vector<column_desc> schema, size_t size) : _size(size) {
+    for (auto &desc : schema) {
+      for (auto &col : _columns)
+        if (col.name == desc.name)
+          throw std::invalid_argument("duplicate column " + desc.name);
+      if (desc.jagged ? desc.lengths.size() != size : !desc.lengths.empty())
+        throw std::invalid_argument("lengths of column " + desc.name + " do not match its elements");
+
+      column_layout col{std::move(desc.name), desc.type, desc.jagged, _byte_size, size, {}};
+      if (col.jagged) {
+        col.offsets.resize(size + 1);
+        for (size_t i = 0; i < size; i++)
+          col.offsets[i + 1] = col.offsets[i] + desc.lengths[i];
+        col.size = col.offsets.back();
+      }
+      _byte_size += align_size(col.size * scalar_size(col.type), Alignment);
+      _columns.push_back(std::move(col));
+    }
+  }
+
+  // Bytes of the block
+  auto byte_size() const -> size_t { return _byte_size; }
+
+  // Attach the block, byte_size() bytes at base
+  auto bind(std::byte *base) -> void { this->base = base; }
+
+  auto size() const -> size_t { return _size; }
+  auto n_columns() const -> size_t { return _columns.size(); }
+
+  // Schema of the columns, with the lengths of the jagged ones
+  auto schema() const -> std::vector<column_desc> {
+    std::vector<column_desc> schema;
+    for (auto &col : _columns) {
+      schema.push_back({col.name, col.type, col.jagged, {}});
+      for (size_t i = 0; col.jagged && i < _size; i++)
+        schema.back().lengths.push_back(col.offsets[i + 1] - col.offsets[i]);
+    }
+    return schema;
+  }
+
+  // Resolve a column by name, throwing std::invalid_argument if there is none or if it holds other scalars
+  template <typename S> auto find(std::string_view name) const -> column_handle<S> {
+    return {index_of(name, scalar_type_of<S>(), false)};
+  }
+
+  template <typename S> auto find_jagged(std::string_view name) const -> jagged_column_handle<S> {
+    return {index_of(name, scalar_type_of<S>(), true)};
+  }
+
+  // Values of a fixed column, one per element
+  template <typename S> auto operator[](column_handle<S> c) -> std::span<S> {
+    return std::span(reinterpret_cast<S *>(base + _columns[c.index].offset), _size);
+  }
+  template <typename S> auto operator[](column_handle<S> c) const -> std::span<const S> {
+    return std::span(reinterpret_cast<const S *>(base + _columns[c.index].offset), _size);
+  }
+
+  // Payloads of a jagged column, back to back
+  template <typename S> auto operator[](jagged_column_handle<S> c) -> std::span<S> {
+    return std::span(reinterpret_cast<S *>(base + _columns[c.index].offset), _columns[c.index].size);
+  }
+  template <typename S> auto operator[](jagged_column_handle<S> c) const -> std::span<const S> {
+    return std::span(reinterpret_cast<const S *>(base + _columns[c.index].offset), _columns[c.index].size);
+  }
+
+  // Payload of element idx of a jagged column
+  template <typename S> auto operator()(jagged_column_handle<S> c, size_t idx) -> std::span<S> {
+    auto &offsets = _columns[c.index].offsets;
+    return (*this)[c].subspan(offsets[idx], offsets[idx + 1] - offsets[idx]);
+  }
+  template <typename S> auto operator()(jagged_column_handle<S> c, size_t idx) const -> std::span<const S> {
+    auto &offsets = _columns[c.index].offsets;
+    return (*this)[c].subspan(offsets[idx], offsets[idx + 1] - offsets[idx]);
+  }
+
+  // Layout of the elements of src selected by idx, to be filled with gather once bound
+  template <size_t SrcAlignment>
+  static auto select(const column_set<SrcAlignment> &src, std::span<const size_t> idx) -> column_set {
+    auto schema = src.schema();
+    for (auto &desc : schema) {
+      if (!desc.jagged)
+        continue;
+      std::vector<size_t> lengths(idx.size());
+      for (size_t k = 0; k < idx.size(); k++)
+        lengths[k] = desc.lengths[idx[k]];
+      desc.lengths = std::move(lengths);
+    }
+    return column_set(std::move(schema), idx.size());
+  }
+
+  // Copy the elements of src selected by idx, into a layout made by select
+  template <size_t SrcAlignment> auto gather(const column_set<SrcAlignment> &src, std::span<const size_t> idx) -> void {
+    for (size_t c_idx = 0; c_idx < _columns.size(); c_idx++) {
+      auto &from = src._columns[c_idx];
+      auto &to = _columns[c_idx];
+      size_t scalar = scalar_size(to.type);
+      for (size_t k = 0; k < idx.size(); k++) {
+        if (to.jagged)
+          std::memcpy(base + to.offset + to.offsets[k] * scalar, src.base + from.offset + from.offsets[idx[k]] * scalar,
+                      (to.offsets[k + 1] - to.offsets[k]) * scalar);
+        else
+          std::memcpy(base + to.offset + k * scalar, src.base + from.offset + idx[k] * scalar, scalar);
+      }
+    }
+  }
+};
+
+// Vector of runtime described columns only, in one block of aligned storage, zero initialized
+template <size_t Alignment> class dynamic_vector {
+  std::vector<std::byte> storage;
+  column_set<Alignment> _columns;
+
+public:
+  dynamic_vector(std::vector<column_desc> schema, size_t size) : _columns(std::move(schema), size) {
+    storage.resize(_columns.byte_size());
+    _columns.bind(storage.data());
+    std::cout << "storage of " << storage.size() << " bytes in total\n\n";
+  }
+
+  // Moving keeps the block in place, copying would not
+  dynamic_vector(dynamic_vector &&) = default;
+  dynamic_vector(const dynamic_vector &) = delete;
+  auto operator=(const dynamic_vector &) -> dynamic_vector & = delete;
+
+  auto size() const -> std::size_t { return _columns.size(); }
+
+  // Columns, e.g. columns()[columns().find<float>("energy")] for the values of column energy
+  auto columns() -> column_set<Alignment> & { return _columns; }
+  auto columns() const -> const column_set<Alignment> & { return _columns; }
+};
+
 template <typename T, size_t Alignment> class vector {
+  template <typename, size_t> friend class vector;
+
 private:
   std::vector<std::byte> storage;
   size_t _size; // Number of elements
+  static constexpr size_t n_members = nonstatic_data_members_of(^T).size();
+
+  column_set<Alignment> _columns; // Runtime described columns, after the storage vectors in storage
+
+  // Write tracking, see track_writes
+  std::vector<dirty_bitmap> dirty; // Per storage vector, empty unless writes are tracked
+  size_t granule = 0;
+  bool reallocated = false; // The layout changed since the last flush, which then rewrites the whole image
+  enum class write_sink { none, image, stream } sink = write_sink::none; // The one consumer of the tracked writes
 
 public: // internal data public for debugging
   struct sov_metadata {
@@ -144,8 +866,32 @@ public: // internal data public for debugging
     consteval { gen_sor_members(^T); }
   };
 
+  struct aos_ref {
+    consteval { gen_aos_ref_members(^T); }
+  };
+
+  static constexpr size_t cache_line_size = 64;
+
+  // Reference from the start of an image, see image_header
+  struct image_ref {
+    uint64_t offset, size; // Offset in bytes, size in elements
+  };
+
+  // An image of a vector is position independent, so that it can be mapped at any address by any process. It holds
+  // this header, followed by the metadata of the jagged storage vectors and by storage, each aligned to Alignment.
+  struct image_header {
+    uint64_t magic;
+    uint64_t members;   // Number of storage vectors
+    uint64_t size;      // Number of elements
+    uint64_t byte_size; // Size of the whole image
+    image_ref sov[n_members];
+    image_ref md[n_members]; // Metadata of jagged storage vectors, validity bitmap of nullable ones
+  };
+
+  static constexpr uint64_t image_magic = 0x31676d692d73646d; // "mds-img1"
+
   // Helper function to compute aligned size
-  constexpr inline size_t align_size(size_t size, size_t alignment) {
+  static constexpr size_t align_size(size_t size, size_t alignment) {
     return ((size + alignment - 1) / alignment) * alignment;
   }
 
@@ -161,37 +907,30 @@ public: // internal data public for debugging
             \id("_"sv, name_of(Member), "_md"sv).push_back({.offset = size, .size = n_elements});
           });
         }
-        byte_size += align_size(sizeof(vec_type[n_elements]), Alignment);
+        byte_size += align_size(n_elements * sizeof(vec_type), Alignment);
         size += n_elements;
       }
+    } else if constexpr (type_is_optional(type_of(Member))) {
+      byte_size = nullable_byte_size<typename[:get_scalar_type(type_of(Member)):]>(data.size());
+      size = data.size();
     } else {
-      byte_size = align_size(sizeof(typename[:type_of(Member):][data.size()]), Alignment);
+      byte_size = align_size(data.size() * sizeof(typename[:type_of(Member):]), Alignment);
       size = data.size();
     }
 
     std::cout << "_" << name_of(Member) << " = " << size << " elements in " << byte_size << " bytes\n";
   }
 
-public:
-  vector(std::initializer_list<T> data) {
-    auto n_members = [:std::meta::reflect_value(nonstatic_data_members_of(^T).size()):];
-    _size = data.size();
-
-    std::vector<size_t> sizes(n_members);
-    byte_sizes.resize(n_members);
+  // Carve the storage vectors out of storage, given the number of scalars in each of them and byte_sizes
+  auto allocate(const std::vector<size_t> &sizes) -> void {
     size_t total_byte_size = 0;
+    for (auto byte_size : byte_sizes)
+      total_byte_size += byte_size;
+    storage.resize(total_byte_size + _columns.byte_size());
+
+    // Loop over storage vectors
+    size_t offset = 0;
     size_t m_idx = 0;
-    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
-      compute_sizes<e>(data, sizes[m_idx], byte_sizes[m_idx]);
-      total_byte_size += byte_sizes[m_idx++];
-    };
-
-    storage.resize(total_byte_size);
-    std::cout << "storage of " << total_byte_size << " bytes in total\n\n";
-
-    // Loop over storage vectors
-    size_t offset = 0;
-    m_idx = 0;
     [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
       // reading sizes directly in queue injection doesn't seem to work?
       // results in a "cannot capture sizes" error
@@ -202,15 +941,255 @@ public:
         auto type = get_scalar_type(type_of(e));
 
         // Assign required bytes to storage vector e.g.,
-        //    _x = std::span(reinterpret_cast<double*>(storage.data()) + offset,
+        //    _x = std::span(reinterpret_cast<double*>(storage.data() + offset),
         //                   sizes[m_idx]);
         queue_injection(^{
           \id("_"sv, name) = std::span(reinterpret_cast<[: \(type):] *>(storage.data() + offset), sov_size);
         });
+
+        // The validity bitmap of a nullable storage vector follows its values, e.g.
+        //    _w_valid = std::span(reinterpret_cast<uint64_t *>(storage.data() + offset +
+        //                         align_size(sov_size * sizeof(double), Alignment)), bitmap_words(sov_size));
+        if (type_is_optional(type_of(e))) {
+          queue_injection(^{
+            \id("_"sv, name, "_valid"sv) = std::span(
+                reinterpret_cast<uint64_t *>(storage.data() + offset +
+                                             align_size(sov_size * sizeof([: \(type):]), Alignment)),
+                bitmap_words(sov_size));
+            std::fill(\id("_"sv, name, "_valid"sv).begin(), \id("_"sv, name, "_valid"sv).end(), 0);
+          });
+        }
       }
       offset += byte_sizes[m_idx++];
+    };
+
+    _columns.bind(storage.data() + offset);
+
+    if (!dirty.empty()) {
+      for (m_idx = 0; m_idx < n_members; m_idx++)
+        dirty[m_idx] = dirty_bitmap(byte_sizes[m_idx], granule);
+      reallocated = true;
+    }
+  }
+
+  // Bytes of a nullable storage vector of n elements: the values, then the validity bitmap
+  template <typename U, size_t A = Alignment> static constexpr auto nullable_byte_size(size_t n) -> size_t {
+    return align_size(n * sizeof(U), A) + align_size(bitmap_words(n) * sizeof(uint64_t), A);
+  }
+
+  // Ask the cache for the metadata of element idx of every jagged storage vector
+  auto prefetch_metadata(std::size_t idx) const -> void {
+    consteval {
+      for (auto member : nonstatic_data_members_of(^T)) {
+        if (type_is_container(type_of(member))) {
+          // e.g., __builtin_prefetch(&_v_md[idx]);
+          queue_injection(^{
+            __builtin_prefetch(&\id("_"sv, name_of(member), "_md"sv)[idx]);
+          });
+        }
+      }
+    }
+  }
+
+  // Ask the cache for row idx of every storage vector, including the payload of jagged ones. Reads the metadata of
+  // element idx, which should have been prefetched beforehand.
+  auto prefetch(std::size_t idx) const -> void {
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+      if constexpr (type_is_container(type_of(e))) {
+        using vec_type = typename[:type_of(e):] ::value_type;
+        consteval {
+          // e.g., prefetch_payload(_v.data() + _v_md[idx].offset, _v_md[idx].size * sizeof(int));
+          queue_injection(^{
+            prefetch_payload(\id("_"sv, name_of(e)).data() + \id("_"sv, name_of(e), "_md"sv)[idx].offset,
+                             \id("_"sv, name_of(e), "_md"sv)[idx].size * sizeof(vec_type));
+          });
+        }
+      } else {
+        consteval {
+          // e.g., __builtin_prefetch(&_x[idx]);
+          queue_injection(^{
+            __builtin_prefetch(&\id("_"sv, name_of(e))[idx]);
+          });
+          if (type_is_optional(type_of(e))) {
+            // e.g., __builtin_prefetch(&_w_valid[idx / 64]);
+            queue_injection(^{
+              __builtin_prefetch(&\id("_"sv, name_of(e), "_valid"sv)[idx / 64]);
+            });
+          }
+        }
+      }
+    };
+  }
+
+  // Ask the cache for every line of a jagged payload
+  static auto prefetch_payload(const void *payload, size_t byte_size) -> void {
+    for (size_t b = 0; b < byte_size; b += cache_line_size)
+      __builtin_prefetch(static_cast<const std::byte *>(payload) + b);
+  }
+
+  // Index of a member of T among the storage vectors
+  template <std::meta::info Member> static consteval auto member_index() -> size_t {
+    size_t m_idx = 0;
+    for (auto member : nonstatic_data_members_of(^T)) {
+      if (member == Member)
+        return m_idx;
+      m_idx++;
+    }
+    throw "not a member of T";
+  }
+
+  // Storage vector of a member of T, the values of a nullable member
+  template <std::meta::info Member> auto sov() const -> std::span<typename[:get_scalar_type(type_of(Member)):]> {
+    consteval {
+      // e.g., return _x;
+      queue_injection(^{
+        return \id("_"sv, name_of(Member));
+      });
+    }
+  }
+
+  // Record a write of size bytes at offset in storage vector m_idx
+  auto mark_dirty(size_t m_idx, size_t offset, size_t size) -> void {
+    if (!dirty.empty())
+      dirty[m_idx].mark(offset, size);
+  }
+
+  // Record a write of element idx in every storage vector
+  auto mark_row(size_t idx) -> void {
+    size_t m_idx = 0;
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+      using scalar_type = typename[:get_scalar_type(type_of(e)):];
+      if constexpr (type_is_container(type_of(e))) {
+        consteval {
+          // e.g., mark_dirty(m_idx, _v_md[idx].offset * sizeof(int), _v_md[idx].size * sizeof(int));
+          queue_injection(^{
+            mark_dirty(m_idx, \id("_"sv, name_of(e), "_md"sv)[idx].offset * sizeof(scalar_type),
+                       \id("_"sv, name_of(e), "_md"sv)[idx].size * sizeof(scalar_type));
+          });
+        }
+      } else {
+        mark_dirty(m_idx, idx * sizeof(scalar_type), sizeof(scalar_type));
+        if constexpr (type_is_optional(type_of(e))) {
+          consteval {
+            // e.g., mark_dirty(m_idx, align_size(_w.size() * sizeof(double), Alignment) + idx / 64 * sizeof(uint64_t),
+            //                  sizeof(uint64_t));
+            queue_injection(^{
+              mark_dirty(m_idx,
+                         align_size(\id("_"sv, name_of(e)).size() * sizeof(scalar_type), Alignment) +
+                             idx / 64 * sizeof(uint64_t),
+                         sizeof(uint64_t));
+            });
+          }
+        }
+      }
+      m_idx++;
+    };
+  }
+
+  auto clear_dirty() -> void {
+    for (auto &bitmap : dirty)
+      bitmap.clear();
+    reallocated = false;
+  }
+
+  // Tracked writes are consumed by their first sink, an image or a delta stream, as another one would miss the ranges
+  // it consumed
+  auto claim_dirty(write_sink s) -> void {
+    if (sink != write_sink::none && sink != s)
+      throw std::runtime_error("tracked writes go to one image or one delta stream, call track_writes to switch");
+    sink = s;
+  }
+
+  // Throw unless an image passes a consistency check
+  static auto check_image(bool valid) -> void {
+    if (!valid)
+      throw std::runtime_error("corrupt mds::vector image");
+  }
+
+  // Values of type S referenced by ref in an image of byte_size bytes at base, checked to lie within it and be aligned
+  template <typename S>
+  static auto image_span(const std::byte *base, size_t byte_size, const image_ref &ref) -> std::span<const S> {
+    check_image(ref.offset <= byte_size && ref.size <= (byte_size - ref.offset) / sizeof(S) &&
+                ref.offset % alignof(S) == 0);
+    return std::span(reinterpret_cast<const S *>(base + ref.offset), ref.size);
+  }
+
+  // Check that the jagged metadata of an image has one entry per element, each within the n_scalars of its storage
+  // vector
+  static auto check_jagged(std::span<const sov_metadata> md, size_t n_elements, size_t n_scalars) -> void {
+    check_image(md.size() == n_elements);
+    for (auto [offset, size] : md)
+      check_image(offset <= n_scalars && size <= n_scalars - offset);
+  }
+
+  auto image_layout() const -> image_header {
+    image_header header{};
+    header.magic = image_magic;
+    header.members = n_members;
+    header.size = _size;
+    size_t offset = align_size(sizeof(image_header), Alignment);
+
+    size_t m_idx = 0;
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+      if constexpr (type_is_container(type_of(e))) {
+        consteval {
+          // e.g., header.md[m_idx] = {offset, _v_md.size()};
+          queue_injection(^{
+            header.md[m_idx] = {offset, \id("_"sv, name_of(e), "_md"sv).size()};
+          });
+        }
+        offset += align_size(sizeof(sov_metadata) * header.md[m_idx].size, Alignment);
+      }
+      m_idx++;
+    };
+
+    m_idx = 0;
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+      consteval {
+        // e.g., header.sov[m_idx] = {offset, _x.size()};
+        queue_injection(^{
+          header.sov[m_idx] = {offset, \id("_"sv, name_of(e)).size()};
+        });
 
-      // Fill storage spans
+        // e.g., header.md[m_idx] = {offset + align_size(_w.size() * sizeof(double), Alignment), _w_valid.size()};
+        if (type_is_optional(type_of(e))) {
+          queue_injection(^{
+            header.md[m_idx] = {
+                offset + align_size(\id("_"sv, name_of(e)).size() * sizeof([: \(get_scalar_type(type_of(e))):]),
+                                    Alignment),
+                \id("_"sv, name_of(e), "_valid"sv).size()};
+          });
+        }
+      }
+      offset += byte_sizes[m_idx++];
+    };
+
+    header.byte_size = offset;
+    return header;
+  }
+
+public:
+  vector(std::initializer_list<T> data) : vector(data, {}) {}
+
+  // Vector with runtime described columns besides the members of T, zero initialized. They are stored in the same
+  // block, but are not part of images, Arrow exports or tracked writes.
+  vector(std::initializer_list<T> data, std::vector<column_desc> schema) : _columns(std::move(schema), data.size()) {
+    auto n_members = [:std::meta::reflect_value(nonstatic_data_members_of(^T).size()):];
+    _size = data.size();
+
+    std::vector<size_t> sizes(n_members);
+    byte_sizes.resize(n_members);
+    size_t m_idx = 0;
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+      compute_sizes<e>(data, sizes[m_idx], byte_sizes[m_idx]);
+      m_idx++;
+    };
+
+    allocate(sizes);
+    std::cout << "storage of " << storage.size() << " bytes in total\n\n";
+
+    // Fill storage spans
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
       size_t e_idx = 0;
       for (auto &elem : data) {
         if constexpr (type_is_container(type_of(e))) {
@@ -225,6 +1204,18 @@ public:
             }
             e_idx++;
           }
+        } else if constexpr (type_is_optional(type_of(e))) {
+          using value_type = typename[:get_scalar_type(type_of(e)):];
+          consteval {
+            // e.g, new (&_w[e_idx]) double(elem.w.value_or(double{}));
+            //      if (elem.w) _w_valid[e_idx / 64] |= uint64_t(1) << (e_idx % 64);
+            queue_injection(^{
+              new (&\id("_"sv, name_of(e))[e_idx]) value_type(elem.[:e:].value_or(value_type{}));
+              if (elem.[:e:])
+                \id("_"sv, name_of(e), "_valid"sv)[e_idx / 64] |= uint64_t(1) << (e_idx % 64);
+            });
+          }
+          e_idx++;
         } else {
           consteval {
             // e.g, new (&_x[e_idx]) double(elem.x);
@@ -241,35 +1232,726 @@ public:
   auto size() const -> std::size_t { return _size; }
 
   auto operator[](std::size_t m_idx) const -> aos_view {
+    consteval { gen_aos_view(^T); }
+  }
+
+  // Runtime described columns, resolved by name once, e.g. columns()[columns().find<float>("energy")]
+  auto columns() -> column_set<Alignment> & { return _columns; }
+  auto columns() const -> const column_set<Alignment> & { return _columns; }
+
+  // Mutable access to element m_idx. Writes are tracked per element: all of element m_idx is recorded as written, in
+  // every storage vector.
+  auto edit(std::size_t m_idx) -> aos_ref {
+    mark_row(m_idx);
+    consteval { gen_aos_view(^T, true); }
+  }
+
+  // Mutable access to the values of a member for the elements [first, first + count), recorded as written. The values
+  // of a jagged member are the payloads of these elements, back to back; the values of a nullable member do not
+  // include its validity bitmap.
+  template <std::meta::info Member>
+  auto values(size_t first, size_t count) -> std::span<typename[:get_scalar_type(type_of(Member)):]> {
+    using value_type = typename[:get_scalar_type(type_of(Member)):];
+    constexpr size_t m_idx = member_index<Member>();
+    if constexpr (type_is_container(type_of(Member))) {
+      consteval {
+        // e.g., size_t end = count ? _v_md[first + count - 1].offset + _v_md[first + count - 1].size : 0;
+        //       first = count ? _v_md[first].offset : 0;
+        queue_injection(^{
+          size_t end = count ? \id("_"sv, name_of(Member), "_md"sv)[first + count - 1].offset +
+                                   \id("_"sv, name_of(Member), "_md"sv)[first + count - 1].size
+                             : 0;
+          first = count ? \id("_"sv, name_of(Member), "_md"sv)[first].offset : 0;
+          count = end - first;
+        });
+      }
+    }
+    mark_dirty(m_idx, first * sizeof(value_type), count * sizeof(value_type));
+    return sov<Member>().subspan(first, count);
+  }
+
+  // Replace every value of a non-nullable member by f(value). Only the granules where a value actually changed are
+  // recorded as written: each granule is transformed in one branch free pass that also compares old and new values.
+  template <std::meta::info Member, typename F> auto transform(F f) -> void {
+    static_assert(!type_is_optional(type_of(Member)), "nullable members are written through edit()");
+    using value_type = typename[:get_scalar_type(type_of(Member)):];
+    constexpr size_t m_idx = member_index<Member>();
+    auto sov = this->sov<Member>();
+
+    size_t step = dirty.empty() ? std::max<size_t>(sov.size(), 1) : granule / sizeof(value_type);
+    for (size_t first = 0; first < sov.size(); first += step) {
+      size_t last = std::min(first + step, sov.size());
+      bool changed = false;
+      for (size_t i = first; i < last; i++) {
+        value_type value = f(sov[i]);
+        changed |= value != sov[i];
+        sov[i] = value;
+      }
+      if (changed)
+        mark_dirty(m_idx, first * sizeof(value_type), (last - first) * sizeof(value_type));
+    }
+  }
+
+  // Fold the values of a member, e.g. reduce<^data::w>(0.0). The validity bitmap of a nullable member masks out its
+  // nulls a word at a time: words of 64 valid values are folded like a dense column, words of nulls are skipped.
+  template <std::meta::info Member, typename U, typename Op = std::plus<>> auto reduce(U init, Op op = {}) const -> U {
+    static_assert(!type_is_container(type_of(Member)), "not a scalar or nullable member");
+    if constexpr (type_is_optional(type_of(Member))) {
+      consteval {
+        // e.g., for (size_t word = 0; word < _w_valid.size(); word++) { uint64_t bits = _w_valid[word]; ...
+        queue_injection(^{
+          for (size_t word = 0; word < \id("_"sv, name_of(Member), "_valid"sv).size(); word++) {
+            uint64_t bits = \id("_"sv, name_of(Member), "_valid"sv)[word];
+            if (bits == ~uint64_t(0))
+              init = mds::reduce(\id("_"sv, name_of(Member)).subspan(word * 64, 64), init, op);
+            else
+              for (; bits; bits &= bits - 1)
+                init = op(init, \id("_"sv, name_of(Member))[word * 64 + std::countr_zero(bits)]);
+          }
+        });
+      }
+      return init;
+    } else {
+      consteval {
+        // e.g., return mds::reduce(_x, init, op);
+        queue_injection(^{
+          return mds::reduce(\id("_"sv, name_of(Member)), init, op);
+        });
+      }
+    }
+  }
+
+  // Fold the values of a jagged member per element into a new column, e.g. reduce_each<^data::v>(0, std::plus<>{})
+  // holds the sum of v for every element. The payloads are packed back to back, so this is a single sequential pass
+  // over the storage vector.
+  template <std::meta::info Member, typename U, typename Op = std::plus<>>
+  auto reduce_each(U init, Op op = {}) const -> std::vector<U> {
+    static_assert(type_is_container(type_of(Member)), "not a jagged member");
+    std::vector<U> out(_size);
     consteval {
-      // gather references to sov elements
-      std::meta::list_builder member_data_tokens{};
-      for (auto member : nonstatic_data_members_of(^T)) {
-        auto name = name_of(member);
-        auto sov_name = ^{
-          \id("_"sv, name)
+      // e.g., out[i] = mds::reduce(_v.subspan(_v_md[i].offset, _v_md[i].size), init, op);
+      queue_injection(^{
+        for (size_t i = 0; i < _size; i++)
+          out[i] = mds::reduce(\id("_"sv, name_of(Member))
+                                   .subspan(\id("_"sv, name_of(Member), "_md"sv)[i].offset,
+                                            \id("_"sv, name_of(Member), "_md"sv)[i].size),
+                               init, op);
+      });
+    }
+    return out;
+  }
+
+  // Number of bytes of the image of this vector
+  auto image_size() const -> size_t { return image_layout().byte_size; }
+
+  // Write the image of this vector to dst, which holds image_size() bytes
+  auto write_image(std::byte *dst) const -> void {
+    auto header = image_layout();
+    std::memcpy(dst, &header, sizeof(header));
+
+    size_t m_idx = 0;
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+      if constexpr (type_is_container(type_of(e))) {
+        consteval {
+          // e.g., std::memcpy(dst + header.md[m_idx].offset, _v_md.data(), sizeof(sov_metadata) * _v_md.size());
+          queue_injection(^{
+            if (!\id("_"sv, name_of(e), "_md"sv).empty())
+              std::memcpy(dst + header.md[m_idx].offset, \id("_"sv, name_of(e), "_md"sv).data(),
+                          sizeof(sov_metadata) * \id("_"sv, name_of(e), "_md"sv).size());
+          });
+        }
+      }
+      m_idx++;
+    };
+
+    if (!storage.empty())
+      std::memcpy(dst + header.sov[0].offset, storage.data(), header.byte_size - header.sov[0].offset);
+  }
+
+  // Write the image of this vector to the file behind fd, e.g. a POSIX shared memory object or a memfd
+  auto share(int fd) const -> void {
+    size_t byte_size = image_size();
+    if (ftruncate(fd, byte_size) != 0)
+      throw std::system_error(errno, std::generic_category(), "ftruncate");
+    void *base = mmap(nullptr, byte_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+      throw std::system_error(errno, std::generic_category(), "mmap");
+    write_image(static_cast<std::byte *>(base));
+    munmap(base, byte_size);
+  }
+
+  // Publish the image of this vector as the POSIX shared memory object name, e.g. "/points". An existing object is
+  // resized rather than truncated, so that processes attached to it never fault on its pages; they still see the image
+  // being rewritten, and should attach anew after the layout changed.
+  auto share(const char *name) const -> void {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "shm_open");
+    try {
+      share(fd);
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+  }
+
+  static auto unshare(const char *name) -> void { shm_unlink(name); }
+
+  // Range of bytes of a storage vector written since the last flush, offset from the start of the storage vector. Also
+  // the record of a delta stream, followed by the size bytes written.
+  struct dirty_range {
+    uint64_t member, offset, size;
+  };
+
+  static constexpr uint64_t delta_magic = 0x31746c642d73646d; // "mds-dlt1"
+
+  // Start tracking the writes made through edit, values and transform, at the granularity of granule bytes, e.g. a
+  // cache line or a page. The image flushed to must hold the current contents, as written by share. Every flush and
+  // write_delta consumes the ranges written so far, so the writes of a vector are tracked for one image or one stream,
+  // whichever comes first: switching to the other throws until track_writes is called again.
+  auto track_writes(size_t granule = cache_line_size) -> void {
+    if (!std::has_single_bit(granule) || granule < cache_line_size)
+      throw std::invalid_argument("the granule of write tracking must be a power of two of at least a cache line");
+    this->granule = granule;
+    dirty.clear();
+    for (size_t m_idx = 0; m_idx < n_members; m_idx++)
+      dirty.emplace_back(byte_sizes[m_idx], granule);
+    reallocated = false;
+    sink = write_sink::none;
+  }
+
+  // Ranges written since the last flush, in order of storage vector and offset
+  auto dirty_ranges() const -> std::vector<dirty_range> {
+    std::vector<dirty_range> ranges;
+    for (size_t m_idx = 0; m_idx < dirty.size(); m_idx++)
+      dirty[m_idx].for_each_range([&](size_t offset, size_t size) { ranges.push_back({m_idx, offset, size}); });
+    return ranges;
+  }
+
+  // Write the ranges written since the last flush to the image in the file behind fd, or the whole image if storage
+  // was reallocated since
+  auto flush(int fd) -> void {
+    claim_dirty(write_sink::image);
+    if (reallocated) {
+      share(fd);
+    } else {
+      auto header = image_layout();
+      for (auto [m_idx, offset, size] : dirty_ranges())
+        pwrite_all(fd, storage.data() + header.sov[m_idx].offset - header.sov[0].offset + offset, size,
+                   header.sov[m_idx].offset + offset);
+    }
+    clear_dirty();
+  }
+
+  // Flush to the POSIX shared memory object name, see flush(int)
+  auto flush(const char *name) -> void {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "shm_open");
+    try {
+      flush(fd);
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+  }
+
+  // Flush to a mapped image, which holds image_size() bytes after a reallocation
+  auto flush(std::byte *image) -> void {
+    claim_dirty(write_sink::image);
+    if (reallocated) {
+      write_image(image);
+    } else {
+      auto header = image_layout();
+      for (auto [m_idx, offset, size] : dirty_ranges())
+        std::memcpy(image + header.sov[m_idx].offset + offset,
+                    storage.data() + header.sov[m_idx].offset - header.sov[0].offset + offset, size);
+    }
+    clear_dirty();
+  }
+
+  // Write the ranges written since the last flush as a delta stream: delta_magic, the number of records, then the
+  // records. The receiver applies it to its image with apply_delta. A reallocation cannot be expressed as a delta, and
+  // needs the whole image to be sent instead.
+  auto write_delta(std::ostream &os) -> void {
+    claim_dirty(write_sink::stream);
+    if (reallocated)
+      throw std::runtime_error("storage was reallocated since the last flush, the whole image must be sent");
+
+    auto header = image_layout();
+    auto ranges = dirty_ranges();
+    uint64_t head[2] = {delta_magic, ranges.size()};
+    os.write(reinterpret_cast<const char *>(head), sizeof(head));
+    for (auto &range : ranges) {
+      os.write(reinterpret_cast<const char *>(&range), sizeof(range));
+      os.write(reinterpret_cast<const char *>(storage.data()) + header.sov[range.member].offset -
+                   header.sov[0].offset + range.offset,
+               range.size);
+    }
+    if (!os)
+      throw std::runtime_error("cannot write delta stream");
+    clear_dirty();
+  }
+
+  // Apply a delta stream written by write_delta to an image of the same layout, e.g. the mapping of a replica
+  static auto apply_delta(std::istream &is, std::byte *image) -> void {
+    image_header header;
+    std::memcpy(&header, image, sizeof(header));
+    if (header.magic != image_magic || header.members != n_members)
+      throw std::runtime_error("not an image of this mds::vector");
+
+    uint64_t head[2];
+    if (!is.read(reinterpret_cast<char *>(head), sizeof(head)) || head[0] != delta_magic)
+      throw std::runtime_error("not a delta stream");
+    for (uint64_t r = 0; r < head[1]; r++) {
+      dirty_range range;
+      if (!is.read(reinterpret_cast<char *>(&range), sizeof(range)))
+        throw std::runtime_error("truncated delta stream");
+      if (range.member >= n_members)
+        throw std::runtime_error("delta stream does not match the image layout");
+      uint64_t begin = header.sov[range.member].offset;
+      uint64_t end = range.member + 1 < n_members ? header.sov[range.member + 1].offset : header.byte_size;
+      if (range.offset > end - begin || range.size > end - begin - range.offset)
+        throw std::runtime_error("delta stream does not match the image layout");
+      if (!is.read(reinterpret_cast<char *>(image + header.sov[range.member].offset + range.offset), range.size))
+        throw std::runtime_error("truncated delta stream");
+    }
+  }
+
+  // Read only access to the image of a vector published by another process. The image is mapped read only and
+  // shared, so that reads are served from the pages shared by every process attached to it. Spans are resolved from
+  // the offsets in the image once, when attaching, and checked to lie within it.
+  class shared_view {
+    std::byte *base = nullptr;
+    size_t byte_size = 0;
+    size_t _size = 0;
+
+    consteval { gen_shared_view_members(^T); }
+
+  public:
+    explicit shared_view(int fd) {
+      struct stat st;
+      if (fstat(fd, &st) != 0)
+        throw std::system_error(errno, std::generic_category(), "fstat");
+      if (static_cast<size_t>(st.st_size) < sizeof(image_header))
+        throw std::runtime_error("not an mds::vector image");
+
+      byte_size = st.st_size;
+      void *mapping = mmap(nullptr, byte_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapping == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(), "mmap");
+      base = static_cast<std::byte *>(mapping);
+
+      try {
+        image_header header;
+        std::memcpy(&header, base, sizeof(header));
+        if (header.magic != image_magic || header.members != n_members || header.byte_size > byte_size)
+          throw std::runtime_error("not an image of this mds::vector");
+
+        _size = header.size;
+        size_t m_idx = 0;
+        [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+          consteval {
+            auto name = name_of(e);
+            auto type = get_scalar_type(type_of(e));
+
+            // e.g., _x = image_span<double>(base, byte_size, header.sov[m_idx]);
+            queue_injection(^{
+              \id("_"sv, name) = image_span<typename[:\(type):]>(base, byte_size, header.sov[m_idx]);
+            });
+            if (type_is_container(type_of(e))) {
+              // e.g., _v_md = image_span<sov_metadata>(base, byte_size, header.md[m_idx]);
+              //       check_jagged(_v_md, _size, _v.size());
+              queue_injection(^{
+                \id("_"sv, name, "_md"sv) = image_span<sov_metadata>(base, byte_size, header.md[m_idx]);
+                check_jagged(\id("_"sv, name, "_md"sv), _size, \id("_"sv, name).size());
+              });
+            } else {
+              queue_injection(^{
+                check_image(\id("_"sv, name).size() == _size);
+              });
+            }
+            if (type_is_optional(type_of(e))) {
+              // e.g., _w_valid = image_span<uint64_t>(base, byte_size, header.md[m_idx]);
+              queue_injection(^{
+                \id("_"sv, name, "_valid"sv) = image_span<uint64_t>(base, byte_size, header.md[m_idx]);
+                check_image(\id("_"sv, name, "_valid"sv).size() >= bitmap_words(_size));
+              });
+            }
+          }
+          m_idx++;
         };
+      } catch (...) {
+        munmap(base, byte_size);
+        throw;
+      }
+    }
 
-        if (type_is_container(type_of(member))) {
-          auto md_name = ^{
-            \id("_"sv, name, "_md"sv)
-          };
-          member_data_tokens += ^{
-            .\id(name) = \tokens(sov_name).subspan(\tokens(md_name)[m_idx].offset, \tokens(md_name)[m_idx].size)
-          };
-        } else {
-          member_data_tokens += ^{
-            .\id(name) = \tokens(sov_name)[m_idx]
-          };
+    // Attach to the POSIX shared memory object name
+    static auto attach(const char *name) -> shared_view {
+      int fd = shm_open(name, O_RDONLY, 0);
+      if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "shm_open");
+      try {
+        shared_view view(fd);
+        close(fd);
+        return view;
+      } catch (...) {
+        close(fd);
+        throw;
+      }
+    }
+
+    shared_view(shared_view &&other) noexcept
+        : base(std::exchange(other.base, nullptr)), byte_size(other.byte_size), _size(other._size) {
+      consteval {
+        for (auto member : nonstatic_data_members_of(^T)) {
+          // e.g., _x = other._x;
+          queue_injection(^{
+            \id("_"sv, name_of(member)) = other.\id("_"sv, name_of(member));
+          });
+          if (type_is_container(type_of(member))) {
+            queue_injection(^{
+              \id("_"sv, name_of(member), "_md"sv) = other.\id("_"sv, name_of(member), "_md"sv);
+            });
+          }
+          if (type_is_optional(type_of(member))) {
+            queue_injection(^{
+              \id("_"sv, name_of(member), "_valid"sv) = other.\id("_"sv, name_of(member), "_valid"sv);
+            });
+          }
         }
       }
+    }
+    shared_view(const shared_view &) = delete;
+    auto operator=(const shared_view &) -> shared_view & = delete;
 
-      // Injects:
-      //     return aos_view(.x = _x[idx], .v = _v.subspan(_v_md[idx].offset, _v_md[idx].size));
-      queue_injection(^{
-        return aos_view{\tokens(member_data_tokens)};
-      });
+    ~shared_view() {
+      if (base)
+        munmap(base, byte_size);
     }
+
+    auto size() const -> std::size_t { return _size; }
+
+    auto operator[](std::size_t m_idx) const -> aos_view {
+      consteval { gen_aos_view(^T); }
+    }
+  };
+
+  // Export as an Arrow struct array with one child per member, jagged members being list arrays of their scalars and
+  // nullable members carrying their validity bitmap. The storage vectors are shared rather than copied, so this vector
+  // must outlive the exported array; only the list offsets are built from the jagged metadata.
+  auto export_arrow(ArrowSchema *schema, ArrowArray *array) const -> void {
+    std::vector<ArrowSchema> fields;
+    std::vector<ArrowArray> columns;
+
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+      using scalar_type = typename[:get_scalar_type(type_of(e)):];
+      if constexpr (type_is_container(type_of(e))) {
+        fields.push_back(make_arrow_schema("+L", std::string(name_of(e)),
+                                           {make_arrow_schema(arrow_format<scalar_type>(), "item")}));
+
+        std::vector<int64_t> offsets(_size + 1);
+        consteval {
+          // e.g., columns.push_back(make_arrow_array(_size, {nullptr, nullptr},
+          //                                          {make_arrow_array(_v.size(), {nullptr, _v.data()})}, offsets));
+          queue_injection(^{
+            for (size_t i = 0; i < _size; i++)
+              offsets[i + 1] = \id("_"sv, name_of(e), "_md"sv)[i].offset + \id("_"sv, name_of(e), "_md"sv)[i].size;
+            columns.push_back(make_arrow_array(
+                _size, {nullptr, nullptr},
+                {make_arrow_array(\id("_"sv, name_of(e)).size(), {nullptr, \id("_"sv, name_of(e)).data()})},
+                std::move(offsets)));
+          });
+        }
+      } else if constexpr (type_is_optional(type_of(e))) {
+        fields.push_back(
+            make_arrow_schema(arrow_format<scalar_type>(), std::string(name_of(e)), {}, ARROW_FLAG_NULLABLE));
+        consteval {
+          // e.g., columns.push_back(make_arrow_array(_size, {_w_valid.data(), _w.data()}));
+          queue_injection(^{
+            columns.push_back(
+                make_arrow_array(_size, {\id("_"sv, name_of(e), "_valid"sv).data(), \id("_"sv, name_of(e)).data()}));
+            columns.back().null_count = _size;
+            for (auto bits : \id("_"sv, name_of(e), "_valid"sv))
+              columns.back().null_count -= std::popcount(bits);
+          });
+        }
+      } else {
+        fields.push_back(make_arrow_schema(arrow_format<scalar_type>(), std::string(name_of(e))));
+        consteval {
+          // e.g., columns.push_back(make_arrow_array(_size, {nullptr, _x.data()}));
+          queue_injection(^{
+            columns.push_back(make_arrow_array(_size, {nullptr, \id("_"sv, name_of(e)).data()}));
+          });
+        }
+      }
+    };
+
+    *schema = make_arrow_schema("+s", "", std::move(fields));
+    *array = make_arrow_array(_size, {nullptr}, std::move(columns));
+  }
+
+  // Jagged metadata read from the offsets of an Arrow list array
+  struct arrow_offsets {
+    const void *offsets = nullptr;
+    bool large = false; // int64_t offsets of a large list, int32_t otherwise
+
+    auto operator[](size_t i) const -> sov_metadata {
+      if (large) {
+        auto o = static_cast<const int64_t *>(offsets);
+        return {static_cast<size_t>(o[i]), static_cast<size_t>(o[i + 1] - o[i])};
+      }
+      auto o = static_cast<const int32_t *>(offsets);
+      return {static_cast<size_t>(o[i]), static_cast<size_t>(o[i + 1] - o[i])};
+    }
+
+    // Throw unless the offsets of n elements are nondecreasing and within n_values values
+    auto check(size_t n, size_t n_values) const -> void {
+      int64_t previous = 0;
+      for (size_t i = 0; i <= n; i++) {
+        int64_t o = large ? static_cast<const int64_t *>(offsets)[i] : static_cast<const int32_t *>(offsets)[i];
+        if (o < previous || o > static_cast<int64_t>(n_values))
+          throw std::runtime_error("Arrow list offsets out of range");
+        previous = o;
+      }
+    }
+  };
+
+  // Vector over the buffers of a foreign Arrow struct array laid out like the ones of export_arrow, jagged members
+  // being either list or large list arrays. Nothing is copied, and the aos_views must not be written through. Takes
+  // ownership of the array, and releases it when destroyed.
+  class arrow_view {
+    ArrowArray array;
+    size_t _size = 0;
+
+    consteval { gen_arrow_view_members(^T); }
+
+  public:
+    arrow_view(const ArrowSchema *schema, ArrowArray *source) : array(*source) {
+      source->release = nullptr;
+      try {
+        check_arrow_field(schema, &array, "+s");
+        check_arrow_length(schema, &array, 0);
+        if (schema->n_children != n_members || array.n_children != n_members)
+          throw std::runtime_error("Arrow struct does not have one field per member");
+
+        _size = array.length;
+        size_t m_idx = 0;
+        [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+          using scalar_type = typename[:get_scalar_type(type_of(e)):];
+          auto field_schema = schema->children[m_idx];
+          auto field_array = array.children[m_idx++];
+          check_arrow_length(field_schema, field_array, array.offset + array.length);
+
+          if constexpr (type_is_container(type_of(e))) {
+            bool large = std::string_view(field_schema->format) == "+L";
+            check_arrow_field(field_schema, field_array, large ? "+L" : "+l");
+            check_arrow_list(field_schema, field_array);
+            check_arrow_field(field_schema->children[0], field_array->children[0], arrow_format<scalar_type>());
+            check_arrow_length(field_schema->children[0], field_array->children[0], field_array->children[0]->length);
+            auto offsets = static_cast<const std::byte *>(field_array->buffers[1]) +
+                           (array.offset + field_array->offset) * (large ? sizeof(int64_t) : sizeof(int32_t));
+            auto values = field_array->children[0];
+            auto values_data = static_cast<const scalar_type *>(values->buffers[1]) + values->offset;
+            arrow_offsets{offsets, large}.check(_size, values->length);
+            consteval {
+              // e.g., _v_md = {offsets, large};
+              //       _v = std::span(const_cast<int *>(values_data), values->length);
+              queue_injection(^{
+                \id("_"sv, name_of(e), "_md"sv) = {offsets, large};
+                \id("_"sv, name_of(e)) = std::span(const_cast<scalar_type *>(values_data), values->length);
+              });
+            }
+          } else if constexpr (type_is_optional(type_of(e))) {
+            check_arrow_field(field_schema, field_array, arrow_format<scalar_type>(), true);
+            auto field_data =
+                static_cast<const scalar_type *>(field_array->buffers[1]) + array.offset + field_array->offset;
+            arrow_bitmap validity = {static_cast<const uint8_t *>(field_array->buffers[0]),
+                                     static_cast<size_t>(array.offset + field_array->offset)};
+            consteval {
+              // e.g., _w = std::span(const_cast<double *>(field_data), _size);
+              //       _w_valid = validity;
+              queue_injection(^{
+                \id("_"sv, name_of(e)) = std::span(const_cast<scalar_type *>(field_data), _size);
+                \id("_"sv, name_of(e), "_valid"sv) = validity;
+              });
+            }
+          } else {
+            check_arrow_field(field_schema, field_array, arrow_format<scalar_type>());
+            auto field_data =
+                static_cast<const scalar_type *>(field_array->buffers[1]) + array.offset + field_array->offset;
+            consteval {
+              // e.g., _x = std::span(const_cast<double *>(field_data), _size);
+              queue_injection(^{
+                \id("_"sv, name_of(e)) = std::span(const_cast<scalar_type *>(field_data), _size);
+              });
+            }
+          }
+        };
+      } catch (...) {
+        array.release(&array);
+        throw;
+      }
+    }
+
+    arrow_view(arrow_view &&other) noexcept : array(other.array), _size(other._size) {
+      other.array.release = nullptr;
+      consteval {
+        for (auto member : nonstatic_data_members_of(^T)) {
+          // e.g., _x = other._x;
+          queue_injection(^{
+            \id("_"sv, name_of(member)) = other.\id("_"sv, name_of(member));
+          });
+          if (type_is_container(type_of(member))) {
+            queue_injection(^{
+              \id("_"sv, name_of(member), "_md"sv) = other.\id("_"sv, name_of(member), "_md"sv);
+            });
+          }
+          if (type_is_optional(type_of(member))) {
+            queue_injection(^{
+              \id("_"sv, name_of(member), "_valid"sv) = other.\id("_"sv, name_of(member), "_valid"sv);
+            });
+          }
+        }
+      }
+    }
+    arrow_view(const arrow_view &) = delete;
+    auto operator=(const arrow_view &) -> arrow_view & = delete;
+
+    ~arrow_view() {
+      if (array.release)
+        array.release(&array);
+    }
+
+    auto size() const -> std::size_t { return _size; }
+
+    auto operator[](std::size_t m_idx) const -> aos_view {
+      consteval { gen_aos_view(^T); }
+    }
+  };
+
+  // Call f(k, (*this)[idx[k]]) for every k. Indices are processed in batches of Batch: while a batch is visited, the
+  // rows and jagged payloads of the next batch are prefetched, as well as the jagged metadata of the batch after it,
+  // which is needed to locate those payloads.
+  template <size_t Batch = 16, typename F> auto for_each_indexed(std::span<const size_t> idx, F &&f) const -> void {
+    auto prefetch_batch = [&](size_t first, auto &&prefetch_one) {
+      for (size_t k = first; k < std::min(first + Batch, idx.size()); k++)
+        prefetch_one(idx[k]);
+    };
+    auto metadata = [this](size_t i) { prefetch_metadata(i); };
+    auto rows = [this](size_t i) { prefetch(i); };
+
+    prefetch_batch(0, metadata);
+    prefetch_batch(Batch, metadata);
+    prefetch_batch(0, rows);
+    for (size_t first = 0; first < idx.size(); first += Batch) {
+      prefetch_batch(first + 2 * Batch, metadata);
+      prefetch_batch(first + Batch, rows);
+      for (size_t k = first; k < std::min(first + Batch, idx.size()); k++)
+        f(k, (*this)[idx[k]]);
+    }
+  }
+
+  // Copy the elements selected by idx into a dense AoS buffer of at least as many elements, out[k] = (*this)[idx[k]]
+  template <size_t Batch = 16> auto gather(std::span<const size_t> idx, std::span<T> out) const -> void {
+    if (out.size() < idx.size())
+      throw std::invalid_argument("output buffer smaller than the selection");
+    for_each_indexed<Batch>(idx, [&](size_t k, const aos_view &elem) {
+      [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+        consteval {
+          if (type_is_container(type_of(e))) {
+            // e.g., out[k].v.assign(elem.v.begin(), elem.v.end());
+            queue_injection(^{
+              out[k].[:e:].assign(elem.\id(name_of(e)).begin(), elem.\id(name_of(e)).end());
+            });
+          } else {
+            // e.g., out[k].x = elem.x; or out[k].w = elem.w; converting a nullable_ref to a std::optional
+            queue_injection(^{
+              out[k].[:e:] = elem.\id(name_of(e));
+            });
+          }
+        }
+      };
+    });
+  }
+
+  // Copy the elements selected by idx into a dense SoA, out[k] = (*this)[idx[k]], runtime described columns included
+  template <size_t Batch = 16, size_t OutAlignment>
+  auto gather(std::span<const size_t> idx, vector<T, OutAlignment> &out) const -> void {
+    auto n_members = [:std::meta::reflect_value(nonstatic_data_members_of(^T).size()):];
+    out._size = idx.size();
+
+    std::vector<size_t> sizes(n_members);
+    out.byte_sizes.assign(n_members, 0);
+
+    // Size the output from the metadata of the selected elements
+    size_t m_idx = 0;
+    [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+      auto &size = sizes[m_idx];
+      auto &byte_size = out.byte_sizes[m_idx++];
+
+      if constexpr (type_is_container(type_of(e))) {
+        using vec_type = typename[:type_of(e):] ::value_type;
+        consteval {
+          // e.g., for (size_t k = 0; k < idx.size(); k++) {
+          //         out._v_md.push_back({.offset = size, .size = _v_md[idx[k]].size});
+          //         ...
+          queue_injection(^{
+            out.\id("_"sv, name_of(e), "_md"sv).clear();
+            out.\id("_"sv, name_of(e), "_md"sv).reserve(idx.size());
+            for (size_t k = 0; k < idx.size(); k++) {
+              if (k + Batch < idx.size())
+                __builtin_prefetch(&\id("_"sv, name_of(e), "_md"sv)[idx[k + Batch]]);
+              auto n_elements = \id("_"sv, name_of(e), "_md"sv)[idx[k]].size;
+              out.\id("_"sv, name_of(e), "_md"sv).push_back({.offset = size, .size = n_elements});
+              byte_size += out.align_size(n_elements * sizeof(vec_type), OutAlignment);
+              size += n_elements;
+            }
+          });
+        }
+      } else if constexpr (type_is_optional(type_of(e))) {
+        byte_size = nullable_byte_size<typename[:get_scalar_type(type_of(e)):], OutAlignment>(idx.size());
+        size = idx.size();
+      } else {
+        byte_size = out.align_size(idx.size() * sizeof(typename[:type_of(e):]), OutAlignment);
+        size = idx.size();
+      }
+    };
+
+    out._columns = column_set<OutAlignment>::select(_columns, idx);
+    out.allocate(sizes);
+
+    for_each_indexed<Batch>(idx, [&](size_t k, const aos_view &elem) {
+      [:expand(nonstatic_data_members_of(^T)):] >> [&]<auto e> {
+        consteval {
+          if (type_is_container(type_of(e))) {
+            // e.g., std::uninitialized_copy(elem.v.begin(), elem.v.end(), out._v.data() + out._v_md[k].offset);
+            queue_injection(^{
+              std::uninitialized_copy(elem.\id(name_of(e)).begin(), elem.\id(name_of(e)).end(),
+                                      out.\id("_"sv, name_of(e)).data() +
+                                          out.\id("_"sv, name_of(e), "_md"sv)[k].offset);
+            });
+          } else if (type_is_optional(type_of(e))) {
+            // e.g., new (&out._w[k]) double(*elem.w);
+            //       if (elem.w) out._w_valid[k / 64] |= uint64_t(1) << (k % 64);
+            queue_injection(^{
+              new (&out.\id("_"sv, name_of(e))[k]) typename[:\(get_scalar_type(type_of(e))):](*elem.\id(name_of(e)));
+              if (elem.\id(name_of(e)))
+                out.\id("_"sv, name_of(e), "_valid"sv)[k / 64] |= uint64_t(1) << (k % 64);
+            });
+          } else {
+            // e.g., new (&out._x[k]) double(elem.x);
+            queue_injection(^{
+              new (&out.\id("_"sv, name_of(e))[k]) typename[:\(type_of(e)):](elem.\id(name_of(e)));
+            });
+          }
+        }
+      };
+    });
+    out._columns.gather(_columns, idx);
   }
 };
 } // namespace mds
@@ -278,13 +1960,14 @@ public:
 struct data {
   double x;
   std::vector<int> v;
+  std::optional<double> w;
   // std::vector<std::vector<double>> p;
 };
 
 int main() {
-  data e1 = {0, {100, 101, 102, 103}};
-  data e2 = {4, {200}};
-  data e3 = {8, {300, 301}};
+  data e1 = {0, {100, 101, 102, 103}, 1.5};
+  data e2 = {4, {200}, std::nullopt};
+  data e3 = {8, {300, 301}, 2.5};
 
   mds::vector<data, 64> maos = {e1, e2, e3};
 
@@ -307,6 +1990,9 @@ int main() {
       std::cout << name_of(e) << ": ";
       if constexpr (type_is_container(type_of(e))) {
         print_container_addr(maos[i].[:e:]);
+      } else if constexpr (!std::is_reference_v<typename[:type_of(e):]>) {
+        // nullable_ref, held by value
+        std::cout << (long long)&*maos[i].[:e:] << ", ";
       } else {
         std::cout << (long long)&maos[i].[:e:] << ", ";
       }
@@ -328,5 +2014,170 @@ int main() {
     print_container_addr(maos.[:e:]);
   };
 
+  // Random access through a lookup table
+  std::vector<size_t> lookup = {2, 0, 2};
+
+  std::vector<data> aos(lookup.size());
+  maos.gather(lookup, aos);
+
+  mds::vector<data, 64> soa = {};
+  maos.gather(lookup, soa);
+
+  std::cout << "\ngathered " << soa.size() << " elements\n";
+  for (size_t i = 0; i != soa.size(); ++i) {
+    std::cout << "aos[" << i << "] = (";
+    [:expand(nonstatic_data_members_of(^data)):] >> [&]<auto e> {
+      std::cout << name_of(e) << ": ";
+      if constexpr (type_is_container(type_of(e))) {
+        print_container(aos[i].[:e:]);
+      } else if constexpr (type_is_optional(type_of(e))) {
+        if (aos[i].[:e:])
+          std::cout << *aos[i].[:e:] << ", ";
+        else
+          std::cout << "null, ";
+      } else {
+        std::cout << aos[i].[:e:] << ", ";
+      }
+    };
+
+    std::cout << ")\tsoa[" << i << "] = (";
+    [:expand(nonstatic_data_members_of(^decltype(soa[i]))):] >> [&]<auto e> {
+      std::cout << name_of(e) << ": ";
+      if constexpr (type_is_container(type_of(e))) {
+        print_container(soa[i].[:e:]);
+      } else {
+        std::cout << soa[i].[:e:] << ", ";
+      }
+    };
+    std::cout << ")\n";
+  }
+
+  // Jagged reduction
+  auto v_sums = maos.reduce_each<^data::v>(0, std::plus<>{});
+  std::cout << "\nsum(v) per element = ";
+  print_container(v_sums);
+
+  // Reduction over the non-null values of a nullable member
+  std::cout << "sum(w) over non-null w = " << maos.reduce<^data::w>(0.0) << "\n";
+
+  // Zero copy sharing with other processes
+  maos.share("/mds_aosoa2soaos");
+  {
+    auto shared = mds::vector<data, 64>::shared_view::attach("/mds_aosoa2soaos");
+    std::cout << "\nattached " << shared.size() << " elements\n";
+    for (size_t i = 0; i != shared.size(); ++i) {
+      std::cout << "shared[" << i << "] = (";
+      [:expand(nonstatic_data_members_of(^decltype(shared[i]))):] >> [&]<auto e> {
+        std::cout << name_of(e) << ": ";
+        if constexpr (type_is_container(type_of(e))) {
+          print_container(shared[i].[:e:]);
+        } else {
+          std::cout << shared[i].[:e:] << ", ";
+        }
+      };
+      std::cout << ")\n";
+    }
+  }
+  mds::vector<data, 64>::unshare("/mds_aosoa2soaos");
+
+  // Zero copy handoff through the Arrow C data interface
+  ArrowSchema schema;
+  ArrowArray array;
+  maos.export_arrow(&schema, &array);
+  {
+    mds::vector<data, 64>::arrow_view imported(&schema, &array);
+    std::cout << "\nimported " << imported.size() << " elements from Arrow\n";
+    for (size_t i = 0; i != imported.size(); ++i) {
+      std::cout << "imported[" << i << "] = (";
+      [:expand(nonstatic_data_members_of(^decltype(imported[i]))):] >> [&]<auto e> {
+        std::cout << name_of(e) << ": ";
+        if constexpr (type_is_container(type_of(e))) {
+          print_container(imported[i].[:e:]);
+        } else {
+          std::cout << imported[i].[:e:] << ", ";
+        }
+      };
+      std::cout << ")\n";
+    }
+  }
+  schema.release(&schema);
+
+  // Incremental persistence and replication of tracked writes
+  maos.share("/mds_aosoa2soaos");
+  std::vector<std::byte> replica(maos.image_size());
+  maos.write_image(replica.data());
+
+  maos.track_writes();
+  maos.edit(1).x = 5;
+  maos.edit(2).w = std::nullopt;
+  maos.values<^data::v>(0, 1)[3] = 104;
+  maos.transform<^data::x>([](double x) { return x < 1 ? x + 1 : x; });
+
+  std::cout << "\ndirty ranges:";
+  for (auto [member, offset, size] : maos.dirty_ranges())
+    std::cout << " (member " << member << ", offset " << offset << ", size " << size << ")";
+  std::cout << "\n";
+
+  std::stringstream delta;
+  maos.write_delta(delta);
+  mds::vector<data, 64>::apply_delta(delta, replica.data());
+  std::cout << "delta stream of " << delta.str().size() << " bytes for an image of " << replica.size() << " bytes\n";
+
+  // The tracked writes went to the delta stream: bring the shared image up to date and track anew for it
+  maos.share("/mds_aosoa2soaos");
+  maos.track_writes();
+  maos.edit(0).w = 3.5;
+  maos.flush("/mds_aosoa2soaos");
+  {
+    auto shared = mds::vector<data, 64>::shared_view::attach("/mds_aosoa2soaos");
+    std::cout << "flushed " << shared.size() << " elements\n";
+    for (size_t i = 0; i != shared.size(); ++i) {
+      std::cout << "shared[" << i << "] = (";
+      [:expand(nonstatic_data_members_of(^decltype(shared[i]))):] >> [&]<auto e> {
+        std::cout << name_of(e) << ": ";
+        if constexpr (type_is_container(type_of(e))) {
+          print_container(shared[i].[:e:]);
+        } else {
+          std::cout << shared[i].[:e:] << ", ";
+        }
+      };
+      std::cout << ")\n";
+    }
+  }
+  mds::vector<data, 64>::unshare("/mds_aosoa2soaos");
+
+  // Columns only known at run time, next to the members of data
+  mds::vector<data, 64> tagged({e1, e2, e3}, {{"energy", mds::scalar_type::f32},
+                                              {"hits", mds::scalar_type::u16, true, {2, 0, 1}}});
+  auto energy = tagged.columns().find<float>("energy");
+  auto hits = tagged.columns().find_jagged<uint16_t>("hits");
+  auto energies = tagged.columns()[energy];
+  for (size_t i = 0; i != tagged.size(); ++i)
+    energies[i] = 10 * tagged[i].x;
+  std::ranges::copy(std::vector<uint16_t>{7, 8, 9}, tagged.columns()[hits].begin());
+
+  mds::vector<data, 64> picked = {};
+  tagged.gather(lookup, picked);
+  std::cout << "\ngathered " << picked.size() << " elements with runtime columns\n";
+  auto picked_energies = picked.columns()[picked.columns().find<float>("energy")];
+  auto picked_hits = picked.columns().find_jagged<uint16_t>("hits");
+  for (size_t i = 0; i != picked.size(); ++i) {
+    auto hits_i = picked.columns()(picked_hits, i);
+    std::cout << "picked[" << i << "] = (x: " << picked[i].x << ", energy: " << picked_energies[i] << ", hits: ";
+    print_container(hits_i);
+  }
+
+  mds::dynamic_vector<64> extra({{"id", mds::scalar_type::u32}, {"tracks", mds::scalar_type::f64, true, {1, 3}}}, 2);
+  auto ids = extra.columns()[extra.columns().find<uint32_t>("id")];
+  auto tracks = extra.columns().find_jagged<double>("tracks");
+  for (size_t i = 0; i != extra.size(); ++i) {
+    ids[i] = 1000 + i;
+    auto track = extra.columns()(tracks, i);
+    std::fill(track.begin(), track.end(), 0.5 * i);
+  }
+  std::cout << "dynamic vector of " << extra.size() << " elements, " << extra.columns().n_columns()
+            << " columns, id[1] = " << ids[1] << ", sum(tracks) = " << mds::reduce(extra.columns()[tracks], 0.0)
+            << "\n";
+
   return 0;
 }